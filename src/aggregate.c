@@ -0,0 +1,214 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <uv.h>
+
+#include "aggregate.h"
+
+/*
+ * A window is divided into buckets.  A sample is added to the bucket of the
+ * current time slice in O(1).  When time passes into the next slice, results
+ * of the window are recomputed from completed buckets, i.e. the window covers
+ * the latest buckets * bucket_ms milliseconds before the current slice.  The
+ * ring has one more bucket than the window for the slice being filled.
+ */
+typedef struct {
+    uint64_t bucket_ns;
+    unsigned int buckets;   /* Buckets in ring */
+} aggregate_window_t;
+
+static const aggregate_window_t windows[AGGREGATE_WINDOWS] = {
+    [AGGREGATE_1S] = { 100000000, 11 },
+    [AGGREGATE_1MIN] = { 1000000000, 61 },
+};
+
+/* Interval of sliding windows of robots which stopped sending frames. */
+#define AGGREGATE_TICK_MS 100
+
+const char* const aggregate_window_names[AGGREGATE_WINDOWS] = {
+    [AGGREGATE_1S] = "1s",
+    [AGGREGATE_1MIN] = "1min",
+};
+
+const char* const aggregate_stat_names[AGGREGATE_STATS] = {
+    [AGGREGATE_MIN] = "Min",
+    [AGGREGATE_MAX] = "Max",
+    [AGGREGATE_MEAN] = "Mean",
+    [AGGREGATE_RMS] = "Rms",
+};
+
+const char* const aggregate_field_names[AXIS_FIELDS] = {
+    [AXIS_POSITION] = "Position",
+    [AXIS_VELOCITY] = "Velocity",
+    [AXIS_TORQUE] = "Torque",
+    [AXIS_TEMPERATURE] = "Temperature",
+};
+
+static void
+clear_bucket(aggregate_bucket_t* b) {
+    b->count = 0;
+    for (int n = 0; n < AGGREGATE_VALUES; n++) {
+        b->min[n] = INFINITY;
+        b->max[n] = -INFINITY;
+        b->sum[n] = 0.0;
+        b->sum_sq[n] = 0.0;
+    }
+}
+
+/* Move ring to the slice of now_ns.  Returns true if it moved. */
+static bool
+advance(aggregate_ring_t* ring, const aggregate_window_t* w, uint64_t now_ns) {
+    const uint64_t epoch = now_ns / w->bucket_ns;
+    if (epoch == ring->epoch) {
+        return false;
+    }
+    uint64_t passed = epoch - ring->epoch;
+    if (w->buckets < passed) {
+        passed = w->buckets;
+    }
+    for (uint64_t i = 1; i <= passed; i++) {
+        clear_bucket(&ring->bucket[(ring->epoch + i) % w->buckets]);
+    }
+    ring->epoch = epoch;
+    return true;
+}
+
+/* Combine completed buckets of ring into result of the window. */
+static void
+compute_window(const aggregate_ring_t* ring, const aggregate_window_t* w,
+               float out_result[AGGREGATE_STATS][AGGREGATE_VALUES]) {
+    aggregate_bucket_t total;
+    clear_bucket(&total);
+    for (unsigned int i = 1; i < w->buckets; i++) {
+        const aggregate_bucket_t* b = &ring->bucket[(ring->epoch + i) % w->buckets];
+        total.count += b->count;
+        for (int n = 0; n < AGGREGATE_VALUES; n++) {
+            total.min[n] = fminf(total.min[n], b->min[n]);
+            total.max[n] = fmaxf(total.max[n], b->max[n]);
+            total.sum[n] += b->sum[n];
+            total.sum_sq[n] += b->sum_sq[n];
+        }
+    }
+    for (int n = 0; n < AGGREGATE_VALUES; n++) {
+        if (total.count == 0) {
+            out_result[AGGREGATE_MIN][n] = NAN;
+            out_result[AGGREGATE_MAX][n] = NAN;
+            out_result[AGGREGATE_MEAN][n] = NAN;
+            out_result[AGGREGATE_RMS][n] = NAN;
+        } else {
+            out_result[AGGREGATE_MIN][n] = total.min[n];
+            out_result[AGGREGATE_MAX][n] = total.max[n];
+            out_result[AGGREGATE_MEAN][n] = (float) (total.sum[n] / total.count);
+            out_result[AGGREGATE_RMS][n] = (float) sqrt(total.sum_sq[n] / total.count);
+        }
+    }
+}
+
+/* Slide windows of a robot to now_ns and recompute results of moved ones. */
+static void
+slide(aggregates_t* aggs, int robot, uint64_t now_ns) {
+    bool moved[AGGREGATE_WINDOWS];
+    bool any = false;
+    for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+        moved[w] = advance(&aggs->ring[robot][w], &windows[w], now_ns);
+        any |= moved[w];
+    }
+    if (!any) {
+        return;
+    }
+    unsigned int v = atomic_load_explicit(&aggs->lock[robot], memory_order_relaxed);
+    atomic_store_explicit(&aggs->lock[robot], v + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+        if (moved[w]) {
+            compute_window(&aggs->ring[robot][w], &windows[w], aggs->result[robot][w]);
+        }
+    }
+    atomic_store_explicit(&aggs->lock[robot], v + 2, memory_order_release);
+}
+
+static void
+tick(uv_timer_t* handle) {
+    aggregates_t* aggs = handle->data;
+    const uint64_t now = uv_hrtime();
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        if (atomic_load_explicit(&aggs->snapshot->live[r], memory_order_relaxed)) {
+            slide(aggs, r, now);
+        }
+    }
+}
+
+/**
+ * Start rolling aggregates on the async loop
+ *
+ * @param aggs  Aggregates to be initialized.
+ * @param snap  Snapshot samples are taken from.
+ *
+ * Windows of robots which stopped sending frames keep sliding by a timer so
+ * that their results become NaN once the window contains no sample.
+ */
+void
+aggregate_start(aggregates_t* aggs, snapshot_t* snap) {
+    aggs->snapshot = snap;
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+            aggs->ring[r][w].epoch = 0;
+            for (unsigned int i = 0; i < windows[w].buckets; i++) {
+                clear_bucket(&aggs->ring[r][w].bucket[i]);
+            }
+        }
+        atomic_init(&aggs->lock[r], 0);
+    }
+    int err = uv_timer_init(uv_default_loop(), &aggs->tick);
+    assert(err == 0);
+    aggs->tick.data = aggs;
+    err = uv_timer_start(&aggs->tick, tick, AGGREGATE_TICK_MS, AGGREGATE_TICK_MS);
+    assert(err == 0);
+}
+
+/**
+ * Add the latest snapshot values of a robot to its windows
+ *
+ * Called by async loop thread right after a frame of the robot is decoded.
+ * Takes O(1) time per sample except when a window slides.
+ */
+void
+aggregate_update(aggregates_t* aggs, int robot, uint64_t now_ns) {
+    float v[AGGREGATE_VALUES];
+    for (int f = 0; f < AXIS_FIELDS; f++) {
+        memcpy(&v[f * MAX_AXES], aggs->snapshot->value[f][robot], sizeof aggs->snapshot->value[f][robot]);
+    }
+    slide(aggs, robot, now_ns);
+    for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+        aggregate_ring_t* ring = &aggs->ring[robot][w];
+        aggregate_bucket_t* b = &ring->bucket[ring->epoch % windows[w].buckets];
+        b->count++;
+        for (int n = 0; n < AGGREGATE_VALUES; n++) {
+            b->min[n] = v[n] < b->min[n] ? v[n] : b->min[n];
+            b->max[n] = v[n] > b->max[n] ? v[n] : b->max[n];
+            b->sum[n] += v[n];
+            b->sum_sq[n] += (double) v[n] * v[n];
+        }
+    }
+}
+
+/**
+ * Copy consistent results of a robot out
+ *
+ * Returns lock value the copy was taken at.  It is 0 until windows of the
+ * robot slide for the first time and changes every time they slide.
+ */
+unsigned int
+aggregate_read(aggregates_t* aggs, int robot, float out_result[AGGREGATE_WINDOWS][AGGREGATE_STATS][AGGREGATE_VALUES]) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&aggs->lock[robot], memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out_result, aggs->result[robot], sizeof aggs->result[robot]);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&aggs->lock[robot], memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return before;
+}
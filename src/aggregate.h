@@ -0,0 +1,15 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "context.h"
+
+extern const char* const aggregate_window_names[AGGREGATE_WINDOWS];
+extern const char* const aggregate_stat_names[AGGREGATE_STATS];
+extern const char* const aggregate_field_names[AXIS_FIELDS];
+
+void aggregate_start(aggregates_t* aggs, snapshot_t* snap);
+void aggregate_update(aggregates_t* aggs, int robot, uint64_t now_ns);
+unsigned int aggregate_read(aggregates_t* aggs, int robot,
+                            float out_result[AGGREGATE_WINDOWS][AGGREGATE_STATS][AGGREGATE_VALUES]);
+
+#endif
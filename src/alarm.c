@@ -0,0 +1,279 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <open62541/server.h>
+
+#include "alarm.h"
+#include "diagnostics.h"
+#include "log.h"
+
+/* Interval of raising events of transitions queued by async loop thread. */
+#define ALARM_EVENT_INTERVAL_MS 10
+
+#define ALARM_EVENT_NS 1
+#define ALARM_EVENT_TYPE "AxisLimitEventType"
+
+/* Event severity of raised and cleared alarm. */
+#define SEVERITY_RAISED 700
+#define SEVERITY_CLEARED 100
+
+/*
+ * How each alarm kind looks at snapshot values.  Value is taken from field,
+ * made absolute if abs is set, then multiplied by sign so that every rule is
+ * an upper limit.
+ */
+typedef struct {
+    const char* name;
+    int field;
+    bool abs;
+    float sign;
+} alarm_kind_t;
+
+static const alarm_kind_t kinds[ALARM_KINDS] = {
+    [ALARM_SOFT_LIMIT_LOW] = { "soft limit low", AXIS_POSITION, false, -1.0f },
+    [ALARM_SOFT_LIMIT_HIGH] = { "soft limit high", AXIS_POSITION, false, 1.0f },
+    [ALARM_OVERSPEED] = { "overspeed", AXIS_VELOCITY, true, 1.0f },
+    [ALARM_OVERTEMPERATURE] = { "overtemperature", AXIS_TEMPERATURE, false, 1.0f },
+};
+
+/* Build normalized rule table from configuration. */
+static void
+build_rules(alarm_table_t* table, const alarm_conf_t* conf) {
+    for (int k = 0; k < ALARM_KINDS; k++) {
+        for (int r = 0; r < MAX_ROBOTS; r++) {
+            for (int a = 0; a < MAX_AXES; a++) {
+                const int n = r * MAX_AXES + a;
+                if (conf->enabled[k][r][a]) {
+                    table->raise_at[k][n] = (float) (kinds[k].sign * conf->limit[k][r][a]);
+                    table->clear_at[k][n] = (float) (kinds[k].sign * conf->limit[k][r][a] - conf->hysteresis[k][r][a]);
+                } else {
+                    table->raise_at[k][n] = INFINITY;
+                    table->clear_at[k][n] = INFINITY;
+                }
+            }
+        }
+    }
+}
+
+/* Build normalized rule table from configuration and clear every alarm. */
+void
+alarm_init(alarm_table_t* table, const alarm_conf_t* conf) {
+    build_rules(table, conf);
+    memset(table->active, 0, sizeof table->active);
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        atomic_init(&table->head[r], 0);
+        atomic_init(&table->tail[r], 0);
+    }
+    atomic_init(&table->dropped, 0);
+}
+
+/**
+ * Replace limit rules keeping state of every alarm
+ *
+ * Must be called by async loop thread, the caller of alarm_evaluate().  Active
+ * alarm whose rule got disabled or whose new clear level is already reached is
+ * cleared by the next evaluation with a transition as usual.
+ */
+void
+alarm_update_rules(alarm_table_t* table, const alarm_conf_t* conf) {
+    build_rules(table, conf);
+}
+
+static void
+push_transition(alarm_table_t* table, const alarm_transition_t* t) {
+    const int r = t->robot;
+    const unsigned int head = atomic_load_explicit(&table->head[r], memory_order_relaxed);
+    const unsigned int tail = atomic_load_explicit(&table->tail[r], memory_order_acquire);
+    if (head - tail == ALARM_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&table->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    table->queue[r][head & (ALARM_QUEUE_SIZE - 1)] = *t;
+    atomic_store_explicit(&table->head[r], head + 1, memory_order_release);
+}
+
+static bool
+pop_transition(alarm_table_t* table, int robot, alarm_transition_t* out_t) {
+    const unsigned int tail = atomic_load_explicit(&table->tail[robot], memory_order_relaxed);
+    const unsigned int head = atomic_load_explicit(&table->head[robot], memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *out_t = table->queue[robot][tail & (ALARM_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&table->tail[robot], tail + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Evaluate every rule of a robot against snapshot
+ *
+ * @param table Rule table.
+ * @param snap  Snapshot just written by frame decoder.
+ * @param robot Robot whose frame was just decoded.
+ * @param time  When the frame arrived, the time of transitions.
+ *
+ * Must be called by async loop thread, the writer of snapshot, so values are
+ * read without lock.  Called for every decoded frame, so a limit crossing
+ * which clears again by the next frame is raised and cleared as well.  Values
+ * restored from last known value file are never evaluated since no frame
+ * precedes them.
+ */
+void
+alarm_evaluate(alarm_table_t* table, const snapshot_t* snap, int robot, UA_DateTime time) {
+    const int first = robot * MAX_AXES;
+    for (int k = 0; k < ALARM_KINDS; k++) {
+        const float* value = snap->value[kinds[k].field][robot];
+        const float* raise_at = &table->raise_at[k][first];
+        const float* clear_at = &table->clear_at[k][first];
+        uint8_t* active = &table->active[k][first];
+        const float sign = kinds[k].sign;
+        for (int a = 0; a < MAX_AXES; a++) {
+            const float x = (kinds[k].abs ? fabsf(value[a]) : value[a]) * sign;
+            const uint8_t was = active[a];
+            const uint8_t now = x > raise_at[a] || (was && x >= clear_at[a]);
+            if (now == was) {
+                continue;
+            }
+            active[a] = now;
+            const alarm_transition_t t = {
+                .kind = k,
+                .robot = robot,
+                .axis = a,
+                .active = now,
+                .value = value[a],
+                .limit = raise_at[a] * sign,
+                .time = time,
+            };
+            push_transition(table, &t);
+        }
+    }
+}
+
+#ifdef UA_ENABLE_SUBSCRIPTIONS_EVENTS
+static void
+add_event_type(UA_Server* server) {
+    UA_ObjectTypeAttributes attr = UA_ObjectTypeAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", ALARM_EVENT_TYPE);
+    attr.description = UA_LOCALIZEDTEXT("en-US", "Axis value crossed or got back inside its limit");
+    UA_StatusCode err = UA_Server_addObjectTypeNode(server, UA_NODEID_STRING(ALARM_EVENT_NS, ALARM_EVENT_TYPE),
+                                                    UA_NODEID_NUMERIC(0, UA_NS0ID_BASEEVENTTYPE),
+                                                    UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                                    UA_QUALIFIEDNAME(ALARM_EVENT_NS, ALARM_EVENT_TYPE),
+                                                    attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+static void
+raise_event(UA_Server* server, const app_context_t* ctx, const alarm_transition_t* t) {
+    UA_NodeId event_id;
+    UA_StatusCode err = UA_Server_createEvent(server, UA_NODEID_STRING(ALARM_EVENT_NS, ALARM_EVENT_TYPE), &event_id);
+    if (err != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_createEvent", err);
+        return;
+    }
+    char source[32];
+    snprintf(source, sizeof source, "Robot%d/Axis%d", t->robot + 1, t->axis + 1);
+    char message[128];
+    snprintf(message, sizeof message, "%s: %s %s (value %g, limit %g)", source, kinds[t->kind].name,
+             t->active ? "raised" : "cleared", t->value, t->limit);
+    UA_UInt16 severity = t->active ? SEVERITY_RAISED : SEVERITY_CLEARED;
+    UA_LocalizedText text = UA_LOCALIZEDTEXT("en-US", message);
+    UA_String source_name = UA_STRING(source);
+    UA_Server_writeObjectProperty_scalar(server, event_id, UA_QUALIFIEDNAME(0, "Time"),
+                                         &t->time, &UA_TYPES[UA_TYPES_DATETIME]);
+    UA_Server_writeObjectProperty_scalar(server, event_id, UA_QUALIFIEDNAME(0, "Severity"),
+                                         &severity, &UA_TYPES[UA_TYPES_UINT16]);
+    UA_Server_writeObjectProperty_scalar(server, event_id, UA_QUALIFIEDNAME(0, "Message"),
+                                         &text, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
+    UA_Server_writeObjectProperty_scalar(server, event_id, UA_QUALIFIEDNAME(0, "SourceName"),
+                                         &source_name, &UA_TYPES[UA_TYPES_STRING]);
+    err = UA_Server_triggerEvent(server, event_id, ctx->robot_nodes[t->robot].axis[t->axis], NULL, UA_TRUE);
+    if (err != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_triggerEvent", err);
+    }
+}
+#endif
+
+/* Raise events of transitions of robots in the cell queued since previous call. */
+static void
+publish_transitions(UA_Server* server, void* data) {
+    cell_t* cell = data;
+    app_context_t* ctx = cell->ctx;
+    alarm_transition_t t;
+    UA_UInt32 changed = 0;
+    for (size_t i = 0; i < cell->conf.robots_size; i++) {
+        while (pop_transition(&ctx->alarms, cell->conf.robots[i], &t)) {
+            ULINFO("Robot%d/Axis%d: %s %s (value %g, limit %g)", t.robot + 1, t.axis + 1, kinds[t.kind].name,
+                   t.active ? "raised" : "cleared", t.value, t.limit);
+            ctx->robot_nodes[t.robot].active_alarms += t.active ? 1 : -1;
+            cell->active_alarms += t.active ? 1 : -1;
+            changed++;
+#ifdef UA_ENABLE_SUBSCRIPTIONS_EVENTS
+            raise_event(server, ctx, &t);
+#endif
+        }
+    }
+    if (changed != 0) {
+        diagnostics_write(server, "Alarms/ActiveCount", &cell->active_alarms, &UA_TYPES[UA_TYPES_UINT32]);
+        diagnostics_write_uint64(server, "Alarms/DroppedTransitions",
+                                 atomic_load_explicit(&ctx->alarms.dropped, memory_order_relaxed));
+    }
+}
+
+/**
+ * Start raising events of alarm transitions of a robot in a cell
+ *
+ * Axis objects of the robot are made event notifiers.  Active alarms of the
+ * robot, which may be carried over from the cell that exposed it before, are
+ * counted in ActiveCount of the cell.
+ */
+void
+alarm_watch_robot(UA_Server* server, cell_t* cell, int robot) {
+    app_context_t* ctx = cell->ctx;
+#ifdef UA_ENABLE_SUBSCRIPTIONS_EVENTS
+    for (int a = 0; a < MAX_AXES; a++) {
+        UA_StatusCode err = UA_Server_writeEventNotifier(server, ctx->robot_nodes[robot].axis[a],
+                                                         UA_EVENTNOTIFIERTYPE_SUBSCRIBETOEVENTS);
+        assert(err == UA_STATUSCODE_GOOD);
+    }
+#endif
+    cell->active_alarms += ctx->robot_nodes[robot].active_alarms;
+    diagnostics_write(server, "Alarms/ActiveCount", &cell->active_alarms, &UA_TYPES[UA_TYPES_UINT32]);
+}
+
+/*
+ * Stop counting active alarms of a robot leaving a cell.  Its queued
+ * transitions are left to the cell exposing it next.
+ */
+void
+alarm_unwatch_robot(UA_Server* server, cell_t* cell, int robot) {
+    app_context_t* ctx = cell->ctx;
+    cell->active_alarms -= ctx->robot_nodes[robot].active_alarms;
+    diagnostics_write(server, "Alarms/ActiveCount", &cell->active_alarms, &UA_TYPES[UA_TYPES_UINT32]);
+}
+
+/**
+ * Start raising events of alarm transitions of robots in a cell
+ *
+ * Events of type AxisLimitEventType are raised on the Axis object, which is
+ * made an event notifier.  ActiveCount diagnostics counts alarms of the cell
+ * while DroppedTransitions counts those of the whole process.  Without UA_ENABLE_SUBSCRIPTIONS_EVENTS in the
+ * open62541 build transitions are only logged and counted.
+ */
+void
+alarm_start_events(UA_Server* server, cell_t* cell) {
+#ifdef UA_ENABLE_SUBSCRIPTIONS_EVENTS
+    add_event_type(server);
+#else
+    ULINFO("open62541 is built without UA_ENABLE_SUBSCRIPTIONS_EVENTS.  Alarms are only logged.");
+#endif
+    diagnostics_add_object(server, NULL, "Alarms");
+    diagnostics_add_variable(server, "Alarms", "ActiveCount", &UA_TYPES[UA_TYPES_UINT32]);
+    diagnostics_add_variable(server, "Alarms", "DroppedTransitions", &UA_TYPES[UA_TYPES_UINT64]);
+    for (size_t i = 0; i < cell->conf.robots_size; i++) {
+        alarm_watch_robot(server, cell, cell->conf.robots[i]);
+    }
+    UA_StatusCode err = UA_Server_addRepeatedCallback(server, publish_transitions, cell, ALARM_EVENT_INTERVAL_MS, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
@@ -0,0 +1,15 @@
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <open62541/server.h>
+
+#include "context.h"
+
+void alarm_init(alarm_table_t* table, const alarm_conf_t* conf);
+void alarm_update_rules(alarm_table_t* table, const alarm_conf_t* conf);
+void alarm_evaluate(alarm_table_t* table, const snapshot_t* snap, int robot, UA_DateTime time);
+void alarm_start_events(UA_Server* server, cell_t* cell);
+void alarm_watch_robot(UA_Server* server, cell_t* cell, int robot);
+void alarm_unwatch_robot(UA_Server* server, cell_t* cell, int robot);
+
+#endif
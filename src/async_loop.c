@@ -1,39 +1,94 @@
 #include <assert.h>
 #include <uv.h>
 
+#include "aggregate.h"
 #include "async_loop.h"
+#include "device.h"
+#include "lkv.h"
 #include "log.h"
-#include "mvar.h"
+#include "realtime.h"
+#include "reload.h"
+
+/* Interval of logging jitter probe statistics. */
+#define JITTER_LOG_INTERVAL_MS 10000
 
 void
 do_job(uv_async_t* handle) {
     ULTRACE("do_job() is not yet implemented.");
 }
 
+/*
+ * Measure how precisely the async loop wakes up.  Deviation of cycle-to-cycle
+ * interval from configured period shows scheduling jitter of the thread
+ * device I/O runs on.
+ */
+static void
+jitter_probe(uv_timer_t* handle) {
+    app_context_t* ctx = handle->data;
+    jitter_record(&ctx->jitter, uv_hrtime());
+    if (ctx->jitter.samples * ctx->conf.system.jitter_probe_ms >= JITTER_LOG_INTERVAL_MS) {
+        jitter_log_and_reset(&ctx->jitter, "async loop");
+    }
+}
+
 void
 async_loop_init(app_context_t* ctx) {
-    init_mvar_unit(&ctx->ready_mark);
     int err = uv_async_init(uv_default_loop(), &ctx->wakeup, do_job);
     if (err != 0) {
         UVERR("complink_context_init: uv_async_init", err);
     }
     assert(err == 0);
+    const unsigned int period = ctx->conf.system.jitter_probe_ms;
+    if (period != 0) {
+        jitter_init(&ctx->jitter, (uint64_t) period * 1000000);
+        err = uv_timer_init(uv_default_loop(), &ctx->jitter_probe);
+        assert(err == 0);
+        ctx->jitter_probe.data = ctx;
+        err = uv_timer_start(&ctx->jitter_probe, jitter_probe, period, period);
+        assert(err == 0);
+    }
+    aggregate_start(&ctx->aggregates, &ctx->snapshot);
+    lkv_start(ctx);
+    device_link_init(&ctx->robot_link, ctx, "robot", &ctx->conf.robot);
+    device_link_start(&ctx->robot_link);
+    reload_start(ctx);
+}
+
+/**
+ * Start async loop thread
+ *
+ * Thread is pinned and given real-time priority according to
+ * conf.system.async_loop_cpu and conf.system.async_loop_priority.  If the
+ * thread can't be created with them, e.g. lack of privilege for SCHED_FIFO,
+ * it is created with default attributes.
+ */
+void
+async_loop_start(app_context_t* ctx, pthread_t* out_thread) {
+    pthread_attr_t attr;
+    int err = realtime_thread_attr_init(&attr, ctx->conf.system.async_loop_cpu,
+                                        ctx->conf.system.async_loop_priority);
+    if (err == 0) {
+        err = pthread_create(out_thread, &attr, async_loop_main, ctx);
+        pthread_attr_destroy(&attr);
+        if (err == 0) {
+            return;
+        }
+        SYSERR("pthread_create with real-time attributes", err);
+    }
+    err = pthread_create(out_thread, NULL, async_loop_main, ctx);
+    assert(err == 0);
 }
 
 void*
 async_loop_main(void* context) {
     app_context_t* ctx = context;
-    put_mvar(&ctx->ready_mark, NULL);
+    realtime_prefault_stack();
+    latch_count_down(&ctx->startup);
     uv_run(uv_default_loop(), UV_RUN_DEFAULT);
     ULTRACE("Asynchronous networking loop finished.");
     return NULL;
 }
 
-void
-async_loop_wait_before_main_loop(app_context_t* ctx) {
-    read_mvar(NULL, &ctx->ready_mark);
-}
-
 void
 async_loop_wakeup(app_context_t* ctx) {
     int err = uv_async_send(&ctx->wakeup);
@@ -1,11 +1,13 @@
 #ifndef ASYNC_LOOP_H
 #define ASYNC_LOOP_H
 
+#include <pthread.h>
+
 #include "context.h"
 
 void async_loop_init(app_context_t* ctx);
+void async_loop_start(app_context_t* ctx, pthread_t* out_thread);
 void* async_loop_main(void* context);
-void async_loop_wait_before_main_loop(app_context_t* ctx);
 void async_loop_wakeup(app_context_t* ctx);
 
 #endif
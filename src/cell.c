@@ -0,0 +1,320 @@
+#include <assert.h>
+#include <string.h>
+#include <open62541/plugin/log_stdout.h>
+#include <open62541/server.h>
+#include <open62541/server_config_default.h>
+
+#include "open62541/namespace_di_generated.h"
+#include "open62541/namespace_plc_generated.h"
+#include "open62541/namespace_robot_generated.h"
+#include "alarm.h"
+#include "cell.h"
+#include "device.h"
+#include "diagnostics.h"
+#include "footprint.h"
+#include "log.h"
+#include "realtime.h"
+#include "robot.h"
+
+/*
+ * A cell is a UA_Server instance with its own endpoint port, thread and
+ * MotionDeviceSystem holding a subset of robots.  Every cell shares the device
+ * I/O loop, snapshot and workers through app_context_t and reads them under
+ * per robot sequence locks, so sessions, subscriptions and encoding of
+ * different cells run on different cores.
+ */
+
+/*
+ * Load a generated nodeset and attribute heap it consumed to given part of
+ * footprint.  RSS growth is logged so that builds with and without
+ * NODESET_TYPE_CLOSURE can be compared.
+ */
+static void
+load_nodeset(UA_Server* server, const char* const name, UA_StatusCode (*loader)(UA_Server*),
+             footprint_t* fp, const int part) {
+    size_t heap_before = footprint_heap_bytes();
+    long rss_before = footprint_rss_kb();
+    UA_StatusCode err = loader(server);
+    assert(err == UA_STATUSCODE_GOOD);
+    fp->heap_bytes[part] = footprint_heap_bytes() - heap_before;
+    ULINFO("Loaded %s nodeset: RSS +%ld kB", name, footprint_rss_kb() - rss_before);
+}
+
+/**
+ * Instantiate companion namespaces
+ *
+ * Instantiate companion namespaces such as DI, PLCopen, and Robotics.  Output
+ * dynamically assigned namespace indics.
+ *
+ * @param server Pointer to UA_sServer instance where namespaces will be
+ * instantiated.
+ * @param out_ns Pointer to namespace_index_t where namespace indics for DI,
+ * PLCopen, and Robotics will be written.  Namespace indics are dynamically
+ * assigned by framework and output to here.
+ * @param fp Pointer to footprint_t where heap consumed by each namespace will
+ * be written.
+ */
+static void
+setup_companion_namespaces(UA_Server* server, namespace_index_t* out_ns, footprint_t* fp) {
+    /* create nodes from nodesets */
+    load_nodeset(server, "DI", namespace_di_generated, fp, FOOTPRINT_DI);
+    load_nodeset(server, "PLCopen", namespace_plc_generated, fp, FOOTPRINT_PLC);
+    load_nodeset(server, "Robotics", namespace_robot_generated, fp, FOOTPRINT_ROBOT);
+
+    /* Get namespace indices of companion specifications. */
+    static const UA_String di_url = UA_STRING_STATIC("http://opcfoundation.org/UA/DI/");
+    UA_StatusCode err = UA_Server_getNamespaceByName(server, di_url, &out_ns->ns_di);
+    assert(err == UA_STATUSCODE_GOOD);
+    static const UA_String plc_url = UA_STRING_STATIC("http://PLCopen.org/OpcUa/IEC61131-3/");
+    err = UA_Server_getNamespaceByName(server, plc_url, &out_ns->ns_plc);
+    assert(err == UA_STATUSCODE_GOOD);
+    static const UA_String robot_url = UA_STRING_STATIC("http://opcfoundation.org/UA/Robotics/");
+    err = UA_Server_getNamespaceByName(server, robot_url, &out_ns->ns_robot);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/* Interval of applying configuration reloaded by the async loop. */
+#define CELL_RELOAD_INTERVAL_MS 100
+
+/**
+ * Initialize a cell from configuration
+ *
+ * @param cell  Cell to be initialized.
+ * @param ctx   Application context.  ctx->conf.cells[index] configures the cell.
+ * @param index Index of the cell.
+ *
+ * Robots of the cell are marked owned by it.  Must be called for every cell
+ * before the async loop starts, which may hand reloaded configuration over to
+ * the cell at any time.
+ */
+void
+cell_init(cell_t* cell, app_context_t* ctx, int index) {
+    cell->index = index;
+    cell->conf = ctx->conf.cells[index];
+    cell->target = cell->conf;
+    cell->stale_ms = ctx->conf.robot.stale_ms;
+    cell->ctx = ctx;
+    int err = pthread_mutex_init(&cell->reload_lock, NULL);
+    assert(err == 0);
+    cell->reload_pending = false;
+    for (size_t i = 0; i < cell->conf.robots_size; i++) {
+        atomic_store(&ctx->robot_owner[cell->conf.robots[i]], index);
+    }
+}
+
+/**
+ * Hand reloaded configuration over to a cell
+ *
+ * Called on the async loop.  The server thread of the cell picks it up within
+ * CELL_RELOAD_INTERVAL_MS and adds or removes robots so that the cell exposes
+ * conf->robots.  Port and cpu in conf are ignored; they need restart.
+ *
+ * @param cell      Cell to be reconfigured.
+ * @param conf      New configuration of the cell.
+ * @param stale_ms  New stale_ms of the robot device.
+ */
+void
+cell_request_reload(cell_t* cell, const cell_conf_t* conf, unsigned int stale_ms) {
+    pthread_mutex_lock(&cell->reload_lock);
+    cell->reload_conf = *conf;
+    cell->reload_stale_ms = stale_ms;
+    cell->reload_pending = true;
+    pthread_mutex_unlock(&cell->reload_lock);
+}
+
+static bool
+has_robot(const cell_conf_t* conf, int robot) {
+    for (size_t i = 0; i < conf->robots_size; i++) {
+        if (conf->robots[i] == robot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+remove_robot(UA_Server* server, cell_t* cell, size_t k) {
+    app_context_t* ctx = cell->ctx;
+    const int robot = cell->conf.robots[k];
+    alarm_unwatch_robot(server, cell, robot);
+    device_remove_robot_diagnostics(server, robot);
+    robot_remove(server, cell, robot);
+    cell->conf.robots[k] = cell->conf.robots[--cell->conf.robots_size];
+    /* Release the robot after its nodes are released. */
+    atomic_store(&ctx->robot_owner[robot], -1);
+    device_link_drained(&ctx->robot_link);
+    ULINFO("Cell%d: removed Robot%d", cell->index + 1, robot + 1);
+}
+
+/*
+ * Add robot to the cell unless another cell still exposes it.  The other cell
+ * releases it by its own reload, so it is tried again next time.
+ */
+static void
+add_robot(UA_Server* server, cell_t* cell, int robot) {
+    app_context_t* ctx = cell->ctx;
+    int unowned = -1;
+    if (!atomic_compare_exchange_strong(&ctx->robot_owner[robot], &unowned, cell->index)) {
+        return;
+    }
+    robot_add(server, cell, robot);
+    alarm_watch_robot(server, cell, robot);
+    device_add_robot_diagnostics(server, cell, robot);
+    cell->conf.robots[cell->conf.robots_size++] = robot;
+    ULINFO("Cell%d: added Robot%d", cell->index + 1, robot + 1);
+}
+
+/*
+ * Bring robots of the cell closer to the reloaded configuration.  Runs on the
+ * server thread, the only one touching address space and cell->conf of the
+ * cell, so callbacks publishing values of robots never see a half built robot.
+ */
+static void
+apply_reload(UA_Server* server, void* data) {
+    cell_t* cell = data;
+    pthread_mutex_lock(&cell->reload_lock);
+    if (cell->reload_pending) {
+        cell->target.robots_size = cell->reload_conf.robots_size;
+        memcpy(cell->target.robots, cell->reload_conf.robots, sizeof cell->target.robots);
+        cell->stale_ms = cell->reload_stale_ms;
+        cell->reload_pending = false;
+    }
+    pthread_mutex_unlock(&cell->reload_lock);
+    for (size_t k = cell->conf.robots_size; k-- > 0;) {
+        if (!has_robot(&cell->target, cell->conf.robots[k])) {
+            remove_robot(server, cell, k);
+        }
+    }
+    for (size_t i = 0; i < cell->target.robots_size; i++) {
+        const int robot = cell->target.robots[i];
+        if (!has_robot(&cell->conf, robot)) {
+            add_robot(server, cell, robot);
+        }
+    }
+}
+
+/* Serializes builds of cells unless conf.system.parallel_build. */
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Build address space of a cell on its own server thread.  Heap consumed by
+ * each part of address space is measured exactly only while no other thread
+ * allocates, i.e. when cells are built one after another and before the async
+ * loop starts.
+ */
+static void
+cell_build(cell_t* cell) {
+    const int index = cell->index;
+    footprint_t* const fp = &cell->footprint;
+
+    size_t heap_before = footprint_heap_bytes();
+    UA_Server* server = UA_Server_new();
+    UA_ServerConfig *config = UA_Server_getConfig(server);
+    UA_ServerConfig_setMinimal(config, cell->conf.port, NULL);
+    config->verifyRequestTimestamp = UA_RULEHANDLING_WARN;
+    fp->heap_bytes[FOOTPRINT_NS0] = footprint_heap_bytes() - heap_before;
+
+    setup_companion_namespaces(server, &cell->ns, fp);
+    SVTRACE("Namespace indice: di = %ld, plc = %ld, robot = %ld", cell->ns.ns_di, cell->ns.ns_plc, cell->ns.ns_robot);
+
+    heap_before = footprint_heap_bytes();
+    instantiate_robot_rest_nodes(server, cell);
+    fp->heap_bytes[FOOTPRINT_INSTANCES] = footprint_heap_bytes() - heap_before;
+
+    size_t node_counts[FOOTPRINT_MAX_NAMESPACES];
+    footprint_count_nodes(server, node_counts, FOOTPRINT_MAX_NAMESPACES);
+    fp->nodes[FOOTPRINT_NS0] = node_counts[0];
+    fp->nodes[FOOTPRINT_DI] = node_counts[cell->ns.ns_di];
+    fp->nodes[FOOTPRINT_PLC] = node_counts[cell->ns.ns_plc];
+    fp->nodes[FOOTPRINT_ROBOT] = node_counts[cell->ns.ns_robot];
+    fp->nodes[FOOTPRINT_INSTANCES] = node_counts[1];
+    fp->startup_rss_kb = footprint_rss_kb();
+    ULINFO("Cell%d: port %u, %zu robots", index + 1, cell->conf.port, cell->conf.robots_size);
+    footprint_log_summary(fp);
+
+    diagnostics_init(server);
+    footprint_add_diagnostics(server, fp);
+    robot_start_publishing(server, cell);
+    alarm_start_events(server, cell);
+    device_add_diagnostics(server, cell);
+    UA_StatusCode err = UA_Server_addRepeatedCallback(server, apply_reload, cell, CELL_RELOAD_INTERVAL_MS, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+
+    // addCtrlConfiguration(server, ns);
+
+    cell->server = server;
+}
+
+/*
+ * Server thread of a cell.  When the server fails, e.g. its port is in use,
+ * every cell is stopped so that the process exits with failure.
+ */
+static void*
+cell_main(void* arg) {
+    cell_t* cell = arg;
+    app_context_t* ctx = cell->ctx;
+    const bool parallel = ctx->conf.system.parallel_build;
+    if (!parallel) {
+        pthread_mutex_lock(&build_lock);
+    }
+    cell_build(cell);
+    if (!parallel) {
+        pthread_mutex_unlock(&build_lock);
+    }
+    latch_count_down(&ctx->built);
+    const int cpu = 0 <= cell->conf.cpu ? cell->conf.cpu : ctx->conf.system.server_cpu;
+    realtime_apply_to_self(cpu, ctx->conf.system.server_priority);
+    realtime_prefault_stack();
+
+    /* Endpoint opens here.  Values fill in as devices send frames. */
+    cell->status = UA_Server_run_startup(cell->server);
+    if (cell->status != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_run_startup", cell->status);
+        *cell->running = false;
+        latch_count_down(&ctx->startup);
+        return NULL;
+    }
+    ULINFO("Cell%d: serving on port %u %.1f ms after start", cell->index + 1, cell->conf.port,
+           (uv_hrtime() - ctx->start_ns) / 1e6);
+    latch_count_down(&ctx->startup);
+    while (*cell->running) {
+        UA_Server_run_iterate(cell->server, true);
+    }
+    cell->status = UA_Server_run_shutdown(cell->server);
+    if (cell->status != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_run_shutdown", cell->status);
+    }
+    return NULL;
+}
+
+/**
+ * Start server thread of a cell
+ *
+ * The thread builds address space of the cell, then serves it.  Cells are
+ * built one after another unless conf.system.parallel_build is set.  Each cell
+ * counts ctx->startup down once its endpoint is open or failed to open.
+ * Thread is pinned to conf.cpu, or conf.system.server_cpu when it is -1, and
+ * given conf.system.server_priority after the build.
+ */
+void
+cell_start(cell_t* cell, volatile UA_Boolean* running) {
+    cell->running = running;
+    int err = pthread_create(&cell->thread, NULL, cell_main, cell);
+    assert(err == 0);
+}
+
+void
+cell_join(cell_t* cell) {
+    pthread_join(cell->thread, NULL);
+}
+
+void
+cell_delete(cell_t* cell) {
+    UA_LOG_TRACE(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "Shutting down server of cell %d.", cell->index + 1);
+    if (cell->server != NULL) {
+        UA_Server_delete(cell->server);
+        cell->server = NULL;
+    }
+    UA_NodeId_deleteMembers(&cell->motion_devices);
+    pthread_mutex_destroy(&cell->reload_lock);
+}
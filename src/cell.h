@@ -0,0 +1,12 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include "context.h"
+
+void cell_init(cell_t* cell, app_context_t* ctx, int index);
+void cell_request_reload(cell_t* cell, const cell_conf_t* conf, unsigned int stale_ms);
+void cell_start(cell_t* cell, volatile UA_Boolean* running);
+void cell_join(cell_t* cell);
+void cell_delete(cell_t* cell);
+
+#endif
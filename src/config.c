@@ -0,0 +1,529 @@
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ini.h>
+
+#include "config.h"
+#include "log.h"
+
+static int
+read_bool(bool* out_value, const char* value) {
+    if (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+        *out_value = true;
+    } else if (strcmp(value, "no") == 0 || strcmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+        *out_value = false;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Read a parameter in "[system]" section
+ *
+ * async_loop_cpu: <CPU the async loop thread is pinned to, -1 for no pinning>
+ * server_cpu: <CPU the server thread is pinned to, -1 for no pinning>
+ * async_loop_priority: <SCHED_FIFO priority 1-99 of async loop thread, 0 for default>
+ * server_priority: <SCHED_FIFO priority 1-99 of server thread, 0 for default>
+ * lock_memory: <yes to mlockall() current and future pages>
+ * prefault_heap_kb: <kilobytes of heap pre-faulted at startup>
+ * jitter_probe_ms: <period in msec of async loop jitter probe, 0 to disable>
+ * lkv_path: <file last known values are persisted to, empty to disable>
+ * lkv_interval_ms: <period in msec of writing last known values to lkv_path>
+ * parallel_build: <yes to build cells at once, making their heap footprint approximate>
+ * benchmark: <yes to log throughput of frame decoders and forward kinematics at startup>
+ */
+static int
+read_system_config(system_conf_t* target, const char* name, const char* value) {
+    int n;
+    if (strncmp("async_loop_cpu", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->async_loop_cpu) != 1) {
+            ULERR("Config error: Value of async_loop_cpu must be a CPU number in decimal.");
+            return 0;
+        }
+    } else if (strncmp("server_cpu", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->server_cpu) != 1) {
+            ULERR("Config error: Value of server_cpu must be a CPU number in decimal.");
+            return 0;
+        }
+    } else if (strncmp("async_loop_priority", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->async_loop_priority) != 1
+            || target->async_loop_priority < 0 || 99 < target->async_loop_priority) {
+            ULERR("Config error: Value of async_loop_priority must be between 0 and 99.");
+            return 0;
+        }
+    } else if (strncmp("server_priority", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->server_priority) != 1
+            || target->server_priority < 0 || 99 < target->server_priority) {
+            ULERR("Config error: Value of server_priority must be between 0 and 99.");
+            return 0;
+        }
+    } else if (strncmp("lock_memory", name, INI_MAX_LINE) == 0) {
+        if (!read_bool(&target->lock_memory, value)) {
+            ULERR("Config error: Value of lock_memory must be yes or no.");
+            return 0;
+        }
+    } else if (strncmp("prefault_heap_kb", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &n) != 1 || n < 0) {
+            ULERR("Config error: Value of prefault_heap_kb must be a non-negative decimal.");
+            return 0;
+        }
+        target->prefault_heap_kb = n;
+    } else if (strncmp("jitter_probe_ms", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &n) != 1 || n < 0) {
+            ULERR("Config error: Value of jitter_probe_ms must be a non-negative decimal.");
+            return 0;
+        }
+        target->jitter_probe_ms = n;
+    } else if (strncmp("lkv_path", name, INI_MAX_LINE) == 0) {
+        if (sizeof target->lkv_path <= strlen(value)) {
+            ULERR("Config error: Value of lkv_path is too long.");
+            return 0;
+        }
+        strcpy(target->lkv_path, value);
+    } else if (strncmp("lkv_interval_ms", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &n) != 1 || n <= 0) {
+            ULERR("Config error: Value of lkv_interval_ms must be a positive decimal.");
+            return 0;
+        }
+        target->lkv_interval_ms = n;
+    } else if (strncmp("parallel_build", name, INI_MAX_LINE) == 0) {
+        if (!read_bool(&target->parallel_build, value)) {
+            ULERR("Config error: Value of parallel_build must be yes or no.");
+            return 0;
+        }
+    } else if (strncmp("benchmark", name, INI_MAX_LINE) == 0) {
+        if (!read_bool(&target->benchmark, value)) {
+            ULERR("Config error: Value of benchmark must be yes or no.");
+            return 0;
+        }
+    } else {
+        ULERR("Config error: Unknown parameter %s.", name);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Read comma separated list of up to size decimals into out_values.  Elements
+ * not given are left untouched.  Returns number of elements read or -1 on
+ * error.
+ */
+static int
+read_double_list(double* out_values, size_t size, const char* value) {
+    size_t n = 0;
+    while (*value != '\0') {
+        char* end;
+        double d = strtod(value, &end);
+        if (end == value || size <= n) {
+            return -1;
+        }
+        out_values[n++] = d;
+        while (*end == ' ' || *end == '\t') {
+            end++;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        value = end;
+    }
+    return n;
+}
+
+/**
+ * Read a parameter in "[kinematics]" section
+ *
+ * workers: <number of forward kinematics worker threads, 0 to disable>
+ * dh_a: <comma separated link length of each joint in meters>
+ * dh_d: <comma separated link offset of each joint in meters>
+ * dh_alpha: <comma separated link twist of each joint in degrees>
+ * dh_theta_offset: <comma separated joint angle at zero position in degrees>
+ */
+static int
+read_kinematics_config(kinematics_conf_t* target, const char* name, const char* value) {
+    static const char* const dh_names[DH_PARAMS] = {
+        [DH_A] = "dh_a",
+        [DH_D] = "dh_d",
+        [DH_ALPHA] = "dh_alpha",
+        [DH_THETA_OFFSET] = "dh_theta_offset",
+    };
+    if (strncmp("workers", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->workers) != 1 || target->workers < 0) {
+            ULERR("Config error: Value of workers must be a non-negative decimal.");
+            return 0;
+        }
+        return 1;
+    }
+    for (int i = 0; i < DH_PARAMS; i++) {
+        if (strncmp(dh_names[i], name, INI_MAX_LINE) == 0) {
+            if (read_double_list(target->dh[i], MAX_AXES, value) < 0) {
+                ULERR("Config error: Value of %s must be up to %d comma separated decimals.", name, MAX_AXES);
+                return 0;
+            }
+            return 1;
+        }
+    }
+    ULERR("Config error: Unknown parameter %s.", name);
+    return 0;
+}
+
+/**
+ * Read a parameter in "[alarm]" section
+ *
+ * <kind>: <comma separated limit of each axis>
+ * <kind>_hysteresis: <comma separated hysteresis of each axis>
+ *
+ * where <kind> is one of soft_limit_low, soft_limit_high (position), overspeed
+ * (absolute velocity) and overtemperature (temperature).  A parameter applies
+ * to every robot.  Prefixed by "robotN." it applies only to robot N, e.g.
+ * "robot2.overspeed".  Later parameter overrides earlier one.  Axes without
+ * limit never raise the kind of alarm.
+ */
+static int
+read_alarm_config(alarm_conf_t* target, const char* name, const char* value) {
+    static const char* const kind_names[ALARM_KINDS] = {
+        [ALARM_SOFT_LIMIT_LOW] = "soft_limit_low",
+        [ALARM_SOFT_LIMIT_HIGH] = "soft_limit_high",
+        [ALARM_OVERSPEED] = "overspeed",
+        [ALARM_OVERTEMPERATURE] = "overtemperature",
+    };
+    int first = 0;
+    int last = MAX_ROBOTS - 1;
+    int robot;
+    int prefix_len = 0;
+    if (sscanf(name, "robot%d.%n", &robot, &prefix_len) == 1 && prefix_len != 0) {
+        if (robot < 1 || MAX_ROBOTS < robot) {
+            ULERR("Config error: Robot number of %s must be 1 to %d.", name, MAX_ROBOTS);
+            return 0;
+        }
+        first = last = robot - 1;
+    }
+    const char* const key = name + prefix_len;
+    for (int k = 0; k < ALARM_KINDS; k++) {
+        const size_t len = strlen(kind_names[k]);
+        if (strncmp(kind_names[k], key, len) != 0) {
+            continue;
+        }
+        const bool hysteresis = strcmp(key + len, "_hysteresis") == 0;
+        if (!hysteresis && key[len] != '\0') {
+            continue;
+        }
+        double values[MAX_AXES];
+        int n = read_double_list(values, MAX_AXES, value);
+        if (n < 0) {
+            ULERR("Config error: Value of %s must be up to %d comma separated decimals.", name, MAX_AXES);
+            return 0;
+        }
+        for (int r = first; r <= last; r++) {
+            for (int a = 0; a < n; a++) {
+                if (hysteresis) {
+                    if (values[a] < 0.0) {
+                        ULERR("Config error: Value of %s can't be negative.", name);
+                        return 0;
+                    }
+                    target->hysteresis[k][r][a] = values[a];
+                } else {
+                    target->limit[k][r][a] = values[a];
+                    target->enabled[k][r][a] = true;
+                }
+            }
+        }
+        return 1;
+    }
+    ULERR("Config error: Unknown parameter %s.", name);
+    return 0;
+}
+
+/* Endpoint port of the cell configured when no "[cellN]" section is given. */
+#define DEFAULT_PORT 4840
+
+/*
+ * Read comma separated list of robot numbers, 1 origin, into 0 origin
+ * indices.  Returns 0 on error.
+ */
+static int
+read_robot_list(cell_conf_t* target, const char* value) {
+    target->robots_size = 0;
+    while (*value != '\0') {
+        char* end;
+        long robot = strtol(value, &end, 10);
+        if (end == value || robot < 1 || MAX_ROBOTS < robot || target->robots_size == MAX_ROBOTS) {
+            return 0;
+        }
+        target->robots[target->robots_size++] = robot - 1;
+        while (*end == ' ' || *end == '\t') {
+            end++;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return 0;
+        }
+        value = end;
+    }
+    return 1;
+}
+
+/**
+ * Read a parameter in "[cellN]" section
+ *
+ * port: <endpoint port number of the server of the cell in decimal>
+ * robots: <comma separated robot numbers, 1 origin, exposed by the cell>
+ * cpu: <CPU the server thread of the cell is pinned to, -1 for server_cpu>
+ *
+ * Cells are numbered from 1 without gap.  A robot belongs to at most one
+ * cell.  Without any "[cellN]" section, single cell on port 4840 exposes every
+ * robot.
+ */
+static int
+read_cell_config(cell_conf_t* target, const char* name, const char* value) {
+    if (strncmp("port", name, INI_MAX_LINE) == 0) {
+        unsigned short port;
+        if (sscanf(value, "%hu", &port) != 1 || port == 0) {
+            ULERR("Config error: Value of port must be a valid port number in decimal.");
+            return 0;
+        }
+        target->port = port;
+    } else if (strncmp("robots", name, INI_MAX_LINE) == 0) {
+        if (!read_robot_list(target, value)) {
+            ULERR("Config error: Value of robots must be comma separated robot numbers from 1 to %d.", MAX_ROBOTS);
+            return 0;
+        }
+    } else if (strncmp("cpu", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%d", &target->cpu) != 1 || target->cpu < -1) {
+            ULERR("Config error: Value of cpu must be a CPU number or -1.");
+            return 0;
+        }
+    } else {
+        ULERR("Config error: Unknown parameter %s.", name);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Fill default cell when no cell is configured and check that cells don't
+ * share a port or a robot.  Returns 0 on error.
+ */
+static int
+check_cells(config_t* conf) {
+    if (conf->cells_size == 0) {
+        cell_conf_t* cell = &conf->cells[conf->cells_size++];
+        cell->port = DEFAULT_PORT;
+        cell->cpu = -1;
+        for (int i = 0; i < MAX_ROBOTS; i++) {
+            cell->robots[cell->robots_size++] = i;
+        }
+        return 1;
+    }
+    int owner[MAX_ROBOTS];
+    for (int i = 0; i < MAX_ROBOTS; i++) {
+        owner[i] = -1;
+    }
+    for (size_t c = 0; c < conf->cells_size; c++) {
+        const cell_conf_t* cell = &conf->cells[c];
+        if (cell->port == 0 || cell->robots_size == 0) {
+            ULERR("Config error: cell%zu must have port and robots.", c + 1);
+            return 0;
+        }
+        for (size_t d = 0; d < c; d++) {
+            if (conf->cells[d].port == cell->port) {
+                ULERR("Config error: cell%zu and cell%zu share port %u.", d + 1, c + 1, cell->port);
+                return 0;
+            }
+        }
+        for (size_t i = 0; i < cell->robots_size; i++) {
+            const int robot = cell->robots[i];
+            if (0 <= owner[robot]) {
+                ULERR("Config error: Robot%d belongs to both cell%d and cell%zu.", robot + 1, owner[robot] + 1, c + 1);
+                return 0;
+            }
+            owner[robot] = c;
+        }
+    }
+    for (int i = 0; i < MAX_ROBOTS; i++) {
+        if (owner[i] < 0) {
+            ULINFO("Robot%d belongs to no cell and is not exposed.", i + 1);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Callback function for ini_parse()
+ *
+ * @param user      Pointer to config_t.
+ * @param section   Current section name.
+ * @param name      Parsed variable name.
+ * @param value     Parsed variable value.
+ *
+ * This parser understands section "[robot]", "[plc]", "[system]",
+ * "[kinematics]", "[alarm]" and "[cellN]".
+ * It expects following parameters in "[robot]" and "[plc]" section.
+ *
+ * device_ip: <ipv4 address of device in number dot notation>
+ * device_port: <listening port number of the device in decimal>
+ * stale_ms: <age in milliseconds a robot's latest frame is regarded as stale>
+ * backpressure: <conflate, queue or block; what is done with frames while server threads are behind>
+ * queue_depth: <frames queued per robot with queue or block, up to SAMPLE_QUEUE_SIZE>
+ *
+ * See read_system_config(), read_kinematics_config(), read_alarm_config() and
+ * read_cell_config() for parameters in "[system]", "[kinematics]", "[alarm]"
+ * and "[cellN]" section.
+ *
+ * This configuration reader uses inih package from Ben Hoyt (benhoyt).
+ * https://github.com/benhoyt/inih
+ */
+static int
+read_config_handler(void* user, const char* section, const char* name, const char* value) {
+    config_t* out_conf = user;
+    if (*section == '\0') {
+        ULERR("Config error: Section must be specified.");
+        return 0;
+    }
+    if (strncmp("system", section, INI_MAX_LINE) == 0) {
+        ULTRACE("read_config_handler: found %s = %s in section %s", name, value, section);
+        return read_system_config(&out_conf->system, name, value);
+    }
+    if (strncmp("kinematics", section, INI_MAX_LINE) == 0) {
+        ULTRACE("read_config_handler: found %s = %s in section %s", name, value, section);
+        return read_kinematics_config(&out_conf->kinematics, name, value);
+    }
+    if (strncmp("alarm", section, INI_MAX_LINE) == 0) {
+        ULTRACE("read_config_handler: found %s = %s in section %s", name, value, section);
+        return read_alarm_config(&out_conf->alarm, name, value);
+    }
+    int cell;
+    int section_len = 0;
+    if (sscanf(section, "cell%d%n", &cell, &section_len) == 1 && section[section_len] == '\0') {
+        ULTRACE("read_config_handler: found %s = %s in section %s", name, value, section);
+        if (cell < 1 || MAX_CELLS < cell) {
+            ULERR("Config error: Cell number must be 1 to %d.", MAX_CELLS);
+            return 0;
+        }
+        while (out_conf->cells_size < (size_t) cell) {
+            out_conf->cells[out_conf->cells_size++] = (cell_conf_t) { .cpu = -1 };
+        }
+        return read_cell_config(&out_conf->cells[cell - 1], name, value);
+    }
+    device_conf_t* target;
+    if (strncmp("robot", section, INI_MAX_LINE) == 0) {
+        target = &out_conf->robot;
+    } else if (strncmp("plc", section, INI_MAX_LINE) == 0) {
+        target = &out_conf->plc;
+    } else {
+        ULERR("Config error: Unknown section name.");
+        return 0;
+    }
+    ULTRACE("read_config_handler: found %s = %s in section %s", name, value, section);
+    if (strncmp("device_ip", name, INI_MAX_LINE) == 0) {
+        unsigned int d1, d2, d3, d4;
+        if (sscanf(value, "%u.%u.%u.%u", &d1, &d2, &d3, &d4) != 4) {
+            ULERR("Config error: Value of device_ip must be a valid IPv4 address in number dot notation.");
+            return 0;
+        }
+        if (255 < d1 || 255 < d2 || 255 < d3 || 255 < d4) {
+            ULERR("Config error: Every decimal separated by dot can't exceed 255.");
+            return 0;
+        }
+        target->s_addr = htonl(d1 << 24 | d2 << 16 | d3 << 8 | d4);
+        ULTRACE("read_config_handler: set target->s_addr to 0x%08x", ntohl(target->s_addr));
+    } else if (strncmp("device_port", name, INI_MAX_LINE) == 0) {
+        unsigned short port;
+        if (sscanf(value, "%hu", &port) != 1) {
+            ULERR("Config error: Value of controller_port must be a valid port number in decimal.");
+            return 0;
+        }
+        target->port = htons(port);
+        ULTRACE("read_config_handler: set target->port to %hd", ntohs(target->s_addr));
+    } else if (strncmp("stale_ms", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%u", &target->stale_ms) != 1 || target->stale_ms == 0) {
+            ULERR("Config error: Value of stale_ms must be a positive decimal.");
+            return 0;
+        }
+    } else if (strncmp("backpressure", name, INI_MAX_LINE) == 0) {
+        if (strcmp(value, "conflate") == 0) {
+            target->backpressure = BACKPRESSURE_CONFLATE;
+        } else if (strcmp(value, "queue") == 0) {
+            target->backpressure = BACKPRESSURE_QUEUE;
+        } else if (strcmp(value, "block") == 0) {
+            target->backpressure = BACKPRESSURE_BLOCK;
+        } else {
+            ULERR("Config error: Value of backpressure must be conflate, queue or block.");
+            return 0;
+        }
+    } else if (strncmp("queue_depth", name, INI_MAX_LINE) == 0) {
+        if (sscanf(value, "%u", &target->queue_depth) != 1
+            || target->queue_depth == 0 || SAMPLE_QUEUE_SIZE < target->queue_depth) {
+            ULERR("Config error: Value of queue_depth must be between 1 and %d.", SAMPLE_QUEUE_SIZE);
+            return 0;
+        }
+    } else {
+        ULERR("Config error: Unknown parameter %s.", name);
+        return 0;
+    }
+    return 1;
+}
+
+static const char* const backpressure_names[] = { "conflate", "queue", "block" };
+
+static void
+dump_config(const config_t* const conf) {
+    ULINFO("plc ip addr = %d.%d.%d.%d, port = %d",
+        ntohl(conf->plc.s_addr) >> 24, ntohl(conf->plc.s_addr) >> 16 & 0xff,
+        ntohl(conf->plc.s_addr) >> 8 & 0xff, ntohl(conf->plc.s_addr) & 0xff,
+        ntohs(conf->plc.port));
+    ULINFO("robot ip addr = %d.%d.%d.%d, port = %d",
+        ntohl(conf->robot.s_addr) >> 24, ntohl(conf->robot.s_addr) >> 16 & 0xff,
+        ntohl(conf->robot.s_addr) >> 8 & 0xff, ntohl(conf->robot.s_addr) & 0xff,
+        ntohs(conf->robot.port));
+    ULINFO("robot backpressure = %s, queue depth = %u",
+        backpressure_names[conf->robot.backpressure], conf->robot.queue_depth);
+}
+
+/* Fill configuration with defaults of parameters not given by config file. */
+void
+config_init(config_t* out_conf) {
+    memset(out_conf, 0, sizeof *out_conf);
+    out_conf->plc.stale_ms = 100;
+    out_conf->robot.stale_ms = 100;
+    out_conf->plc.queue_depth = 16;
+    out_conf->robot.queue_depth = 16;
+    out_conf->system.async_loop_cpu = -1;
+    out_conf->system.server_cpu = -1;
+    out_conf->system.lkv_interval_ms = 1000;
+}
+
+/**
+ * Read configuration file
+ *
+ * @param out_conf  Pointer to config_t where read configurations are output.
+ *                  Must be initialized by config_init() before this function
+ *                  is called.
+ * @param path      Path of configuration file.
+ *
+ * Returns 0 on success.  A file with any invalid line fails as a whole, with
+ * out_conf partially written.
+ */
+int
+config_read(config_t* const out_conf, const char* const path) {
+    ULTRACE("config_read: Configuration file name is %s.  Trying open and parse it.", path);
+    const int line = ini_parse(path, read_config_handler, out_conf);
+    if (line < 0) {
+        ULERR("Opening configration file %s failed.", path);
+        return 1;
+    }
+    if (line != 0) {
+        ULERR("Config error: %s line %d is invalid.", path, line);
+        return 1;
+    }
+    if (!check_cells(out_conf)) {
+        return 1;
+    }
+    dump_config(out_conf);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "context.h"
+
+void config_init(config_t* out_conf);
+int config_read(config_t* out_conf, const char* path);
+
+#endif
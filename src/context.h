@@ -1,37 +1,387 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <open62541/server.h>
 #include <uv.h>
 
-#include "mvar.h"
+#include "latch.h"
 
 #define MAX_DEVICES 2
+/* Robots and axes per robot.  Overridable at build time, e.g. -DMAX_ROBOTS=8 -DMAX_AXES=9. */
+#ifndef MAX_ROBOTS
 #define MAX_ROBOTS 4
+#endif
+#ifndef MAX_AXES
 #define MAX_AXES 6
+#endif
+#define MAX_CELLS MAX_ROBOTS
+
+/* What the async loop does with frames of a device while server threads fall behind. */
+typedef enum {
+    BACKPRESSURE_CONFLATE,      /* Keep only the latest values of each robot */
+    BACKPRESSURE_QUEUE,         /* Queue up to queue_depth frames per robot, dropping the oldest when full */
+    BACKPRESSURE_BLOCK,         /* Queue up to queue_depth frames per robot, pausing reads from device when full */
+} backpressure_t;
+
+/* Capacity of per robot sample queue of a device.  Power of two. */
+#define SAMPLE_QUEUE_SIZE 64
 
 typedef struct {
     uint32_t s_addr;
     uint16_t port;
+    unsigned int stale_ms;      /* Age of the latest frame of a robot regarded as stale */
+    backpressure_t backpressure;
+    unsigned int queue_depth;   /* Frames queued per robot, 1 to SAMPLE_QUEUE_SIZE */
 } device_conf_t;
 
+/* Thread placement and memory locking of this process. */
+typedef struct {
+    int async_loop_cpu;         /* CPU the async loop thread is pinned to.  -1 for no pinning. */
+    int server_cpu;             /* CPU the server thread is pinned to.  -1 for no pinning. */
+    int async_loop_priority;    /* SCHED_FIFO priority of async loop thread.  0 for SCHED_OTHER. */
+    int server_priority;        /* SCHED_FIFO priority of server thread.  0 for SCHED_OTHER. */
+    bool lock_memory;           /* mlockall() current and future pages. */
+    size_t prefault_heap_kb;    /* Heap pre-faulted and kept by malloc. */
+    unsigned int jitter_probe_ms;   /* Period of jitter probe on async loop.  0 disables it. */
+    char lkv_path[256];         /* File last known values are kept in.  Empty disables it. */
+    unsigned int lkv_interval_ms;   /* Period of writing last known values to the file */
+    bool parallel_build;        /* Build address spaces of cells at once.  Heap footprint gets approximate. */
+    bool benchmark;             /* Measure and log throughput of frame decoders and kinematics at startup */
+} system_conf_t;
+
+/* Denavit-Hartenberg parameters of each joint, shared by all robots. */
+enum {
+    DH_A,               /* Link length in meters */
+    DH_D,               /* Link offset in meters */
+    DH_ALPHA,           /* Link twist in degrees */
+    DH_THETA_OFFSET,    /* Joint angle at zero position in degrees */
+    DH_PARAMS
+};
+
+typedef struct {
+    int workers;        /* Number of forward kinematics worker threads.  0 disables it. */
+    double dh[DH_PARAMS][MAX_AXES];
+} kinematics_conf_t;
+
+/* Kinds of per axis limit alarm. */
+enum {
+    ALARM_SOFT_LIMIT_LOW,       /* Position below limit */
+    ALARM_SOFT_LIMIT_HIGH,      /* Position above limit */
+    ALARM_OVERSPEED,            /* Absolute velocity above limit */
+    ALARM_OVERTEMPERATURE,      /* Temperature above limit */
+    ALARM_KINDS
+};
+
+/*
+ * Limit rules of every axis.  An alarm is raised when value crosses limit and
+ * cleared when it gets back inside limit by more than hysteresis.
+ */
+typedef struct {
+    bool enabled[ALARM_KINDS][MAX_ROBOTS][MAX_AXES];
+    double limit[ALARM_KINDS][MAX_ROBOTS][MAX_AXES];
+    double hysteresis[ALARM_KINDS][MAX_ROBOTS][MAX_AXES];
+} alarm_conf_t;
+
+/* Server instance exposing a subset of robots on its own port and thread. */
+typedef struct {
+    uint16_t port;              /* Endpoint port number in host byte order */
+    int cpu;                    /* CPU the server thread is pinned to.  -1 for system.server_cpu. */
+    size_t robots_size;
+    int robots[MAX_ROBOTS];     /* 0 origin indices of robots */
+} cell_conf_t;
+
 typedef struct {
     device_conf_t plc;
     device_conf_t robot;
+    system_conf_t system;
+    kinematics_conf_t kinematics;
+    alarm_conf_t alarm;
+    size_t cells_size;
+    cell_conf_t cells[MAX_CELLS];
 } config_t;
 
+/* Per axis values carried by device frames.  Known to tools/tagmap_gen.py as well. */
+enum {
+    AXIS_POSITION,
+    AXIS_VELOCITY,
+    AXIS_TORQUE,
+    AXIS_TEMPERATURE,
+    AXIS_FIELDS
+};
+
+/*
+ * Latest values received from devices.  The same field of all axes of all
+ * robots is laid out contiguously so that it can be processed as one array.
+ * Written by async loop thread and read by server thread under per robot
+ * sequence lock.  See snapshot.h.
+ */
+typedef struct {
+    float value[AXIS_FIELDS][MAX_ROBOTS][MAX_AXES];
+    uint32_t sequence[MAX_ROBOTS];      /* Sequence number of the latest frame */
+    uint64_t timestamp_ns[MAX_ROBOTS];  /* uv_hrtime() when the latest frame arrived */
+    atomic_bool live[MAX_ROBOTS];       /* A frame arrived.  False while values are restored ones. */
+    atomic_uint lock[MAX_ROBOTS];
+} snapshot_t;
+
+/* Alarm raised or cleared, passed from async loop thread to server thread. */
+typedef struct {
+    uint8_t kind;
+    uint8_t robot;
+    uint8_t axis;
+    bool active;
+    float value;
+    float limit;
+    UA_DateTime time;
+} alarm_transition_t;
+
+/* Capacity of alarm transition queue of each robot.  Must be a power of 2. */
+#define ALARM_QUEUE_SIZE 64
+
+/*
+ * Rule table and state of limit alarms
+ *
+ * Thresholds are kept as arrays parallel to snapshot values so that the axes of
+ * a robot are a contiguous slice.  Rules are normalized so that an alarm
+ * is raised when the signed value exceeds raise_at and held while it stays at
+ * clear_at or above.  Disabled rules have both at infinity.
+ *
+ * Evaluated by async loop thread after each decoded frame, which pushes
+ * transitions to the queue of the robot.  Server thread of the cell the robot belongs to pops them and raises
+ * events.
+ */
+typedef struct {
+    float raise_at[ALARM_KINDS][MAX_ROBOTS * MAX_AXES];
+    float clear_at[ALARM_KINDS][MAX_ROBOTS * MAX_AXES];
+    uint8_t active[ALARM_KINDS][MAX_ROBOTS * MAX_AXES];
+    alarm_transition_t queue[MAX_ROBOTS][ALARM_QUEUE_SIZE];
+    atomic_uint head[MAX_ROBOTS];   /* Next slot to be pushed */
+    atomic_uint tail[MAX_ROBOTS];   /* Next slot to be popped */
+    atomic_uint dropped;        /* Transitions dropped because queue was full */
+} alarm_table_t;
+
+/* Sliding windows and statistics of rolling aggregates. */
+enum {
+    AGGREGATE_1S,
+    AGGREGATE_1MIN,
+    AGGREGATE_WINDOWS
+};
+
+enum {
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_MEAN,
+    AGGREGATE_RMS,
+    AGGREGATE_STATS
+};
+
+/* Values aggregated per robot, every field of every axis at [field * MAX_AXES + axis]. */
+#define AGGREGATE_VALUES (AXIS_FIELDS * MAX_AXES)
+/* Buckets in ring of the longest window, one more than buckets in the window. */
+#define AGGREGATE_MAX_BUCKETS 61
+
+/* Statistics of samples arrived in a time slice of a window. */
+typedef struct {
+    uint32_t count;
+    float min[AGGREGATE_VALUES];
+    float max[AGGREGATE_VALUES];
+    double sum[AGGREGATE_VALUES];
+    double sum_sq[AGGREGATE_VALUES];
+} aggregate_bucket_t;
+
+/* Buckets of one window of one robot.  Bucket of epoch e is at e % number of buckets. */
+typedef struct {
+    uint64_t epoch;             /* Epoch of the bucket being filled */
+    aggregate_bucket_t bucket[AGGREGATE_MAX_BUCKETS];
+} aggregate_ring_t;
+
+/*
+ * Rolling aggregates of every axis
+ *
+ * Rings are updated by async loop thread.  Results are recomputed from
+ * completed buckets whenever a window slides and read by server thread under
+ * per robot sequence lock.
+ */
+typedef struct {
+    aggregate_ring_t ring[MAX_ROBOTS][AGGREGATE_WINDOWS];
+    float result[MAX_ROBOTS][AGGREGATE_WINDOWS][AGGREGATE_STATS][AGGREGATE_VALUES];
+    atomic_uint lock[MAX_ROBOTS];
+    uv_timer_t tick;
+    snapshot_t* snapshot;
+} aggregates_t;
+
+/*
+ * Size of receive buffer of a device connection.  Must hold the largest frame.
+ * Sized for a few milliseconds of frames of every robot on one connection so
+ * that a read takes everything arrived while the loop was busy.
+ */
+#define DEVICE_BUFFER_SIZE 16384
+
+/* Frame stream statistics of a robot.  Written by async loop thread, read by server threads. */
+typedef struct {
+    atomic_ullong frames;           /* Frames received */
+    atomic_ullong gaps;             /* Times sequence number skipped forward */
+    atomic_ullong lost;             /* Frames missing in the skips */
+    atomic_ullong out_of_order;     /* Frames whose sequence number isn't newer than previous one */
+    atomic_ullong last_arrival_ns;  /* uv_hrtime() when the latest frame arrived */
+    atomic_ullong conflated;        /* Frames overwritten by newer ones before being published */
+    atomic_ullong dropped;          /* Frames dropped from full sample queue */
+} stream_stats_t;
+
+/* Values of one frame of a robot. */
+typedef struct {
+    float value[AXIS_FIELDS][MAX_AXES];
+    uint32_t sequence;
+    unsigned int version;       /* Snapshot lock value right after the frame was written */
+    UA_DateTime source_time;    /* When the frame arrived */
+} sample_t;
+
+/*
+ * Frames of a robot on their way from the async loop to a server thread.  See
+ * sample_queue.h.
+ */
+typedef struct {
+    atomic_uint head;       /* Count of samples pushed.  Written by async loop. */
+    atomic_uint tail;       /* Count of samples popped or dropped */
+    sample_t samples[SAMPLE_QUEUE_SIZE];
+} sample_queue_t;
+
+/* TCP connection to a device, driven by the async loop. */
+typedef struct {
+    const char* name;
+    const device_conf_t* conf;
+    uv_tcp_t tcp;
+    uv_connect_t connect_req;
+    uv_timer_t retry_timer;
+    bool tcp_open;                      /* tcp is initialized and not closed yet */
+    bool connected;
+    size_t buf_len;
+    uint8_t buf[DEVICE_BUFFER_SIZE];
+    void* ctx;                          /* app_context_t owning this link */
+    bool seen[MAX_ROBOTS];              /* Robot sent a frame on current connection */
+    uint32_t last_sequence[MAX_ROBOTS];
+    stream_stats_t stats[MAX_ROBOTS];
+    sample_queue_t queues[MAX_ROBOTS];  /* Unused with BACKPRESSURE_CONFLATE */
+    uv_async_t resume;                  /* Sent by server threads to resume reading */
+    atomic_bool paused;                 /* Reading is stopped until queues drain */
+    atomic_ullong read_pauses;
+} device_link_t;
+
 typedef struct {
     size_t ns_di;
     size_t ns_plc;
     size_t ns_robot;
 } namespace_index_t;
 
+/*
+ * NodeIds of per robot instance nodes.  They are decided at instantiation and
+ * kept here so that nodes can be accessed later without browsing.
+ */
 typedef struct {
-    uv_async_t wakeup;
+    UA_NodeId motion_device;
+    UA_NodeId axis[MAX_AXES];
+    UA_NodeId actual_position[MAX_AXES];
+    UA_NodeId tcp_pose;
+    UA_NodeId aggregate[MAX_AXES][AGGREGATE_WINDOWS][AGGREGATE_STATS][AXIS_FIELDS];
+    unsigned int published_version;     /* Snapshot lock value last published */
+    unsigned int pose_published_version;
+    unsigned int aggregate_published_version;
+    bool stream_stale;                  /* Frames of the robot stopped arriving */
+    unsigned int restored_version;      /* Snapshot lock value of values restored at startup.  0 if none. */
+    UA_DateTime restored_time;          /* Source timestamp of restored values */
+    UA_UInt32 active_alarms;            /* Alarms of the robot raised and not cleared */
+} robot_nodes_t;
+
+/* Parts of address space memory is attributed to. */
+enum {
+    FOOTPRINT_NS0,          /* Namespace 0 and server core */
+    FOOTPRINT_DI,
+    FOOTPRINT_PLC,
+    FOOTPRINT_ROBOT,
+    FOOTPRINT_INSTANCES,    /* Nodes instantiated by this application */
+    FOOTPRINT_PARTS
+};
+
+/* Memory consumption of address space measured at startup. */
+typedef struct {
+    size_t heap_bytes[FOOTPRINT_PARTS];
+    size_t nodes[FOOTPRINT_PARTS];
+    size_t motion_device_heap_bytes[MAX_ROBOTS];
+    long startup_rss_kb;
+} footprint_t;
+
+/*
+ * Server instance of a cell
+ *
+ * Every cell has its own address space built from the same nodesets, so
+ * namespace indices are kept per cell.  Configuration of a cell is owned by
+ * its server thread.  Reloaded configuration is handed over through
+ * reload_conf and applied by the server thread, see cell_request_reload().
+ */
+typedef struct {
+    int index;
+    cell_conf_t conf;                   /* Robots currently exposed */
+    cell_conf_t target;                 /* Robots to be exposed */
+    unsigned int stale_ms;              /* stale_ms of robot device */
+    void* ctx;                          /* app_context_t owning this cell */
+    UA_Server* server;
+    pthread_t thread;
+    volatile UA_Boolean* running;       /* Server runs while this is true */
+    UA_StatusCode status;               /* Result of UA_Server_run() */
     namespace_index_t ns;
-    mvar_abs_t ready_mark;
+    UA_NodeId motion_devices;           /* MotionDevices folder */
+    footprint_t footprint;
+    UA_UInt32 active_alarms;
+    pthread_mutex_t reload_lock;
+    bool reload_pending;
+    cell_conf_t reload_conf;
+    unsigned int reload_stale_ms;
+} cell_t;
+
+/*
+ * Last known value file mapped to memory.  Layout of the file is private to
+ * lkv.c.
+ */
+typedef struct {
+    void* map;
+    size_t size;
+    uv_timer_t flush_timer;
+    unsigned int flushed_version[MAX_ROBOTS];   /* Snapshot lock value last written */
+} lkv_t;
+
+/* Cycle-to-cycle timing statistics of a periodic activity. */
+typedef struct {
+    uint64_t period_ns;
+    uint64_t last_ns;
+    uint64_t samples;
+    int64_t min_ns;             /* Minimum deviation from period */
+    int64_t max_ns;             /* Maximum deviation from period */
+    int64_t sum_abs_ns;         /* Sum of absolute deviation */
+} jitter_stats_t;
+
+typedef struct {
+    const char* config_path;
+    uv_fs_event_t config_watch;
+    uv_timer_t config_reload;
+    uv_async_t wakeup;
+    uv_timer_t jitter_probe;
+    jitter_stats_t jitter;
+    uint64_t start_ns;                  /* uv_hrtime() when the process started */
+    latch_t startup;                    /* Opens when async loop and every cell serve */
+    latch_t built;                      /* Opens when every cell has built its address space */
     config_t conf;
+    robot_nodes_t robot_nodes[MAX_ROBOTS];
+    atomic_int robot_owner[MAX_ROBOTS];     /* Index of cell exposing the robot or -1 */
+    cell_t cells[MAX_CELLS];
+    snapshot_t snapshot;
+    alarm_table_t alarms;
+    aggregates_t aggregates;
+    device_link_t robot_link;
+    lkv_t lkv;
 } app_context_t;
 
 #endif
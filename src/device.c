@@ -0,0 +1,420 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+#include "aggregate.h"
+#include "alarm.h"
+#include "device.h"
+#include "diagnostics.h"
+#include "frame.h"
+#include "kinematics.h"
+#include "log.h"
+#include "sample_queue.h"
+
+/* Delay before reconnecting to a device after connection failed or closed. */
+#define DEVICE_RETRY_INTERVAL_MS 1000
+
+/* Interval of updating stream diagnostics. */
+#define STREAM_DIAGNOSTICS_INTERVAL_MS 100
+
+static void connect_device(device_link_t* link);
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+
+static void
+retry_connect(uv_timer_t* handle) {
+    device_link_start(handle->data);
+}
+
+static void
+on_closed(uv_handle_t* handle) {
+    device_link_t* link = handle->data;
+    link->tcp_open = false;
+    link->connected = false;
+    link->buf_len = 0;
+    atomic_store(&link->paused, false);
+    /* Device may restart sequence numbers on new connection. */
+    memset(link->seen, 0, sizeof link->seen);
+    int err = uv_timer_start(&link->retry_timer, retry_connect, DEVICE_RETRY_INTERVAL_MS, 0);
+    assert(err == 0);
+}
+
+static void
+close_and_retry(device_link_t* link) {
+    if (!uv_is_closing((uv_handle_t*) &link->tcp)) {
+        uv_close((uv_handle_t*) &link->tcp, on_closed);
+    }
+}
+
+static void
+alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+    device_link_t* link = handle->data;
+    buf->base = (char*) link->buf + link->buf_len;
+    buf->len = sizeof link->buf - link->buf_len;
+}
+
+/*
+ * Track sequence number of a robot.  Frames of all robots are multiplexed on
+ * one connection but each robot numbers its own frames, so a skip in a robot's
+ * sequence means its frames were lost at the device.  Returns false if the
+ * frame is a duplicate or older than the last one of the robot, which must not
+ * overwrite newer values in the snapshot.
+ */
+static bool
+account_frame(device_link_t* link, int robot, uint32_t sequence, uint64_t now_ns) {
+    stream_stats_t* stats = &link->stats[robot];
+    atomic_fetch_add_explicit(&stats->frames, 1, memory_order_relaxed);
+    atomic_store_explicit(&stats->last_arrival_ns, now_ns, memory_order_relaxed);
+    if (link->seen[robot]) {
+        const uint32_t delta = sequence - link->last_sequence[robot];
+        if (delta == 0 || 0x80000000u <= delta) {
+            atomic_fetch_add_explicit(&stats->out_of_order, 1, memory_order_relaxed);
+            return false;
+        }
+        if (1 < delta) {
+            atomic_fetch_add_explicit(&stats->gaps, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stats->lost, delta - 1, memory_order_relaxed);
+        }
+    }
+    link->seen[robot] = true;
+    link->last_sequence[robot] = sequence;
+    return true;
+}
+
+/* Whether frames of a robot go through its sample queue.  Robots no cell exposes aren't queued. */
+static bool
+is_queued(const device_link_t* link, int robot) {
+    app_context_t* ctx = link->ctx;
+    return link->conf->backpressure != BACKPRESSURE_CONFLATE
+        && 0 <= atomic_load_explicit(&ctx->robot_owner[robot], memory_order_relaxed);
+}
+
+/*
+ * With BACKPRESSURE_BLOCK, robot whose sample queue is full and must drain
+ * before the frame is decoded.  -1 if the frame can be decoded.  Frame of
+ * unknown robot doesn't wait and fails to be decoded instead.
+ */
+static int
+must_wait(device_link_t* link, const uint8_t* frame, size_t len) {
+    if (link->conf->backpressure != BACKPRESSURE_BLOCK || len < FRAME_LENGTH_SIZE + 2) {
+        return -1;
+    }
+    const int robot = frame[4] << 8 | frame[5];
+    if (MAX_ROBOTS <= robot || !is_queued(link, robot)
+        || sample_queue_length(&link->queues[robot]) < link->conf->queue_depth) {
+        return -1;
+    }
+    return robot;
+}
+
+/*
+ * Stop reading from device until server thread drains sample queue of the
+ * robot.  Queue is checked again after paused is set, since the server thread
+ * may have drained it, or its cell released the robot, before seeing paused.
+ */
+static void
+pause_reading(device_link_t* link, int robot) {
+    int err = uv_read_stop((uv_stream_t*) &link->tcp);
+    assert(err == 0);
+    atomic_store(&link->paused, true);
+    atomic_fetch_add_explicit(&link->read_pauses, 1, memory_order_relaxed);
+    ULTRACE("%s: reading paused.", link->name);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!is_queued(link, robot) || sample_queue_length(&link->queues[robot]) < link->conf->queue_depth) {
+        err = uv_async_send(&link->resume);
+        assert(err == 0);
+    }
+}
+
+/*
+ * Decode every complete frame in receive buffer straight into snapshot.  A
+ * partial frame at the end is moved to the head of the buffer to be completed
+ * by following reads.  Returns false if stream is broken.
+ *
+ * Frames of different robots may come in any order.  Each frame is
+ * demultiplexed by its robot ID, skipped if its sequence number isn't newer
+ * than the last one of the robot, and decoded in place from the receive buffer
+ * into the snapshot slot of the robot.  Unless backpressure of the device is
+ * BACKPRESSURE_CONFLATE, values are also pushed to the sample queue of the
+ * robot, which the server thread of the cell exposing it drains.  With BACKPRESSURE_BLOCK, a frame whose queue is full is left in the
+ * buffer and reading is paused.
+ */
+static bool
+consume_frames(device_link_t* link) {
+    app_context_t* ctx = link->ctx;
+    const device_conf_t* conf = link->conf;
+    const uint64_t now = uv_hrtime();
+    const UA_DateTime arrival = UA_DateTime_now();
+    size_t pos = 0;
+    while (link->buf_len - pos >= FRAME_LENGTH_SIZE) {
+        const uint8_t* frame = link->buf + pos;
+        const size_t len = FRAME_LENGTH_SIZE + ((size_t) frame[0] << 24 | frame[1] << 16 | frame[2] << 8 | frame[3]);
+        if (sizeof link->buf < len) {
+            ULERR("%s: frame of %zu bytes exceeds receive buffer.", link->name, len);
+            return false;
+        }
+        if (link->buf_len - pos < len) {
+            break;
+        }
+        const int full = must_wait(link, frame, len);
+        if (0 <= full) {
+            pause_reading(link, full);
+            break;
+        }
+        uint32_t sequence;
+        const int robot = frame_check(frame, len, &sequence);
+        if (robot < 0) {
+            ULERR("%s: malformed frame of %zu bytes.", link->name, len);
+            return false;
+        }
+        pos += len;
+        if (!account_frame(link, robot, sequence, now)) {
+            continue;
+        }
+        frame_decode(frame, len, now, &ctx->snapshot);
+        alarm_evaluate(&ctx->alarms, &ctx->snapshot, robot, arrival);
+        aggregate_update(&ctx->aggregates, robot, now);
+        if (is_queued(link, robot)
+            && sample_queue_push(&link->queues[robot], conf->queue_depth, &ctx->snapshot, robot, arrival)) {
+            atomic_fetch_add_explicit(&link->stats[robot].dropped, 1, memory_order_relaxed);
+        }
+    }
+    if (pos != 0) {
+        kinematics_kick();
+    }
+    memmove(link->buf, link->buf + pos, link->buf_len - pos);
+    link->buf_len -= pos;
+    return true;
+}
+
+static void
+on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+    device_link_t* link = stream->data;
+    if (nread < 0) {
+        if (nread != UV_EOF) {
+            UVERR(link->name, (int) nread);
+        }
+        ULINFO("%s: connection closed.", link->name);
+        close_and_retry(link);
+        return;
+    }
+    link->buf_len += nread;
+    if (!consume_frames(link)) {
+        close_and_retry(link);
+    }
+}
+
+/* Decode frames left in buffer and read again if queues have room for them. */
+static void
+resume_reading(uv_async_t* handle) {
+    device_link_t* link = handle->data;
+    if (!atomic_load(&link->paused) || !link->connected || uv_is_closing((uv_handle_t*) &link->tcp)) {
+        return;
+    }
+    atomic_store(&link->paused, false);
+    if (!consume_frames(link)) {
+        close_and_retry(link);
+        return;
+    }
+    if (atomic_load(&link->paused)) {
+        return;
+    }
+    ULTRACE("%s: reading resumed.", link->name);
+    int err = uv_read_start((uv_stream_t*) &link->tcp, alloc_buffer, on_read);
+    if (err != 0) {
+        UVERR("uv_read_start", err);
+        close_and_retry(link);
+    }
+}
+
+static void
+on_connected(uv_connect_t* req, int status) {
+    device_link_t* link = req->data;
+    if (status < 0) {
+        UVERR(link->name, status);
+        close_and_retry(link);
+        return;
+    }
+    ULINFO("%s: connected.", link->name);
+    link->connected = true;
+    uv_tcp_nodelay(&link->tcp, 1);
+    int err = uv_read_start((uv_stream_t*) &link->tcp, alloc_buffer, on_read);
+    if (err != 0) {
+        UVERR("uv_read_start", err);
+        close_and_retry(link);
+    }
+}
+
+static void
+connect_device(device_link_t* link) {
+    int err = uv_tcp_init(uv_default_loop(), &link->tcp);
+    assert(err == 0);
+    link->tcp_open = true;
+    link->tcp.data = link;
+    link->connect_req.data = link;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = link->conf->s_addr;
+    addr.sin_port = link->conf->port;
+    err = uv_tcp_connect(&link->connect_req, &link->tcp, (const struct sockaddr*) &addr, on_connected);
+    if (err != 0) {
+        UVERR("uv_tcp_connect", err);
+        close_and_retry(link);
+    }
+}
+
+void
+device_link_init(device_link_t* link, app_context_t* ctx, const char* name, const device_conf_t* conf) {
+    memset(link, 0, sizeof *link);
+    link->name = name;
+    link->conf = conf;
+    link->ctx = ctx;
+    int err = uv_timer_init(uv_default_loop(), &link->retry_timer);
+    assert(err == 0);
+    link->retry_timer.data = link;
+    err = uv_async_init(uv_default_loop(), &link->resume, resume_reading);
+    assert(err == 0);
+    link->resume.data = link;
+}
+
+/**
+ * Start connecting to device
+ *
+ * Connection is kept by the async loop.  It is re-established after
+ * DEVICE_RETRY_INTERVAL_MS whenever it fails or closes.  Device not configured,
+ * i.e. both address and port are zero, is never connected.
+ */
+void
+device_link_start(device_link_t* link) {
+    if (link->conf->s_addr == 0 && link->conf->port == 0) {
+        ULINFO("%s: not configured.", link->name);
+        return;
+    }
+    connect_device(link);
+}
+
+/**
+ * Reconnect to device with its current configuration
+ *
+ * Called on the async loop after address or port of the device was changed.
+ * Open connection, or attempt of it, is closed and re-established as if it
+ * failed.  Links of other devices are not touched.
+ */
+void
+device_link_restart(device_link_t* link) {
+    ULINFO("%s: reconnecting.", link->name);
+    if (link->tcp_open) {
+        close_and_retry(link);
+        return;
+    }
+    /* Either waiting for retry or never started. */
+    int err = uv_timer_stop(&link->retry_timer);
+    assert(err == 0);
+    device_link_start(link);
+}
+
+/**
+ * Tell the async loop that a sample queue of the device was drained
+ *
+ * Called by server threads, also after a robot is released by its cell.
+ * Reading from device paused by BACKPRESSURE_BLOCK is resumed.  Does nothing
+ * while reading.
+ */
+void
+device_link_drained(device_link_t* link) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&link->paused, memory_order_relaxed)) {
+        int err = uv_async_send(&link->resume);
+        assert(err == 0);
+    }
+}
+
+/* Copy stream statistics of robots of the cell to diagnostics variables. */
+static void
+update_stream_diagnostics(UA_Server* server, void* data) {
+    cell_t* cell = data;
+    app_context_t* ctx = cell->ctx;
+    const device_link_t* link = &ctx->robot_link;
+    const uint64_t now = uv_hrtime();
+    char path[DIAGNOSTICS_PATH_MAX];
+    for (size_t i = 0; i < cell->conf.robots_size; i++) {
+        const int r = cell->conf.robots[i];
+        const stream_stats_t* stats = &link->stats[r];
+        const UA_UInt64 frames = atomic_load_explicit(&stats->frames, memory_order_relaxed);
+        const uint64_t last = atomic_load_explicit(&stats->last_arrival_ns, memory_order_relaxed);
+        const UA_Double age_ms = frames == 0 ? -1.0 : (now - last) / 1e6;
+        const UA_Boolean stale = frames == 0 || cell->stale_ms < age_ms;
+        snprintf(path, sizeof path, "Stream/Robot%d/Frames", r + 1);
+        diagnostics_write_uint64(server, path, frames);
+        snprintf(path, sizeof path, "Stream/Robot%d/SequenceGaps", r + 1);
+        diagnostics_write_uint64(server, path, atomic_load_explicit(&stats->gaps, memory_order_relaxed));
+        snprintf(path, sizeof path, "Stream/Robot%d/LostFrames", r + 1);
+        diagnostics_write_uint64(server, path, atomic_load_explicit(&stats->lost, memory_order_relaxed));
+        snprintf(path, sizeof path, "Stream/Robot%d/OutOfOrderFrames", r + 1);
+        diagnostics_write_uint64(server, path, atomic_load_explicit(&stats->out_of_order, memory_order_relaxed));
+        snprintf(path, sizeof path, "Stream/Robot%d/ConflatedFrames", r + 1);
+        diagnostics_write_uint64(server, path, atomic_load_explicit(&stats->conflated, memory_order_relaxed));
+        snprintf(path, sizeof path, "Stream/Robot%d/DroppedFrames", r + 1);
+        diagnostics_write_uint64(server, path, atomic_load_explicit(&stats->dropped, memory_order_relaxed));
+        snprintf(path, sizeof path, "Stream/Robot%d/AgeMs", r + 1);
+        diagnostics_write(server, path, &age_ms, &UA_TYPES[UA_TYPES_DOUBLE]);
+        snprintf(path, sizeof path, "Stream/Robot%d/Stale", r + 1);
+        diagnostics_write(server, path, &stale, &UA_TYPES[UA_TYPES_BOOLEAN]);
+        robot_nodes_t* nodes = &ctx->robot_nodes[r];
+        if (stale != nodes->stream_stale && frames != 0) {
+            ULINFO("Robot%d: stream %s (age %.1f ms).", r + 1, stale ? "stale" : "recovered", age_ms);
+        }
+        nodes->stream_stale = stale;
+    }
+    diagnostics_write_uint64(server, "Stream/ReadPauses", atomic_load_explicit(&link->read_pauses, memory_order_relaxed));
+}
+
+/* Add Diagnostics/Stream/RobotN of a robot. */
+void
+device_add_robot_diagnostics(UA_Server* server, cell_t* cell, int robot) {
+    app_context_t* ctx = cell->ctx;
+    char robot_name[20];
+    snprintf(robot_name, sizeof robot_name, "Robot%d", robot + 1);
+    diagnostics_add_object(server, "Stream", robot_name);
+    char path[DIAGNOSTICS_PATH_MAX];
+    snprintf(path, sizeof path, "Stream/%s", robot_name);
+    diagnostics_add_variable(server, path, "Frames", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "SequenceGaps", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "LostFrames", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "OutOfOrderFrames", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "ConflatedFrames", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "DroppedFrames", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, path, "AgeMs", &UA_TYPES[UA_TYPES_DOUBLE]);
+    diagnostics_add_variable(server, path, "Stale", &UA_TYPES[UA_TYPES_BOOLEAN]);
+    ctx->robot_nodes[robot].stream_stale = true;
+}
+
+void
+device_remove_robot_diagnostics(UA_Server* server, int robot) {
+    char path[DIAGNOSTICS_PATH_MAX];
+    snprintf(path, sizeof path, "Stream/Robot%d", robot + 1);
+    diagnostics_remove(server, path);
+}
+
+/**
+ * Expose frame stream statistics of robots of a cell as diagnostics
+ *
+ * Creates Diagnostics/Stream/RobotN with frame count, sequence gaps, lost and
+ * out of order frames, frames conflated or dropped by backpressure, age of the
+ * latest frame and whether it is older than stale_ms of the device.  AgeMs is
+ * -1 until the first frame arrives.  Diagnostics/Stream/ReadPauses counts
+ * reads paused by BACKPRESSURE_BLOCK.
+ */
+void
+device_add_diagnostics(UA_Server* server, cell_t* cell) {
+    diagnostics_add_object(server, NULL, "Stream");
+    diagnostics_add_variable(server, "Stream", "ReadPauses", &UA_TYPES[UA_TYPES_UINT64]);
+    for (size_t i = 0; i < cell->conf.robots_size; i++) {
+        device_add_robot_diagnostics(server, cell, cell->conf.robots[i]);
+    }
+    update_stream_diagnostics(server, cell);
+    UA_StatusCode err = UA_Server_addRepeatedCallback(server, update_stream_diagnostics, cell,
+                                                      STREAM_DIAGNOSTICS_INTERVAL_MS, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
@@ -0,0 +1,14 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "context.h"
+
+void device_link_init(device_link_t* link, app_context_t* ctx, const char* name, const device_conf_t* conf);
+void device_link_start(device_link_t* link);
+void device_link_restart(device_link_t* link);
+void device_link_drained(device_link_t* link);
+void device_add_diagnostics(UA_Server* server, cell_t* cell);
+void device_add_robot_diagnostics(UA_Server* server, cell_t* cell, int robot);
+void device_remove_robot_diagnostics(UA_Server* server, int robot);
+
+#endif
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <stdio.h>
+#include <open62541/server.h>
+
+#include "diagnostics.h"
+
+/*
+ * Diagnostics of this application are exposed under Objects/Diagnostics.  Each
+ * node gets string NodeId in namespace 1 equal to its path from Diagnostics,
+ * e.g. "Diagnostics/Footprint/RssBytes", so that it can be written by path.
+ */
+#define DIAGNOSTICS_NS 1
+#define DIAGNOSTICS_ROOT "Diagnostics"
+
+void
+diagnostics_init(UA_Server* server) {
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", DIAGNOSTICS_ROOT);
+    UA_StatusCode err = UA_Server_addObjectNode(server, UA_NODEID_STRING(DIAGNOSTICS_NS, DIAGNOSTICS_ROOT),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                                UA_QUALIFIEDNAME(DIAGNOSTICS_NS, DIAGNOSTICS_ROOT),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),
+                                                attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/**
+ * Add object under diagnostics tree
+ *
+ * @param server        Pointer to UA_Server instance.
+ * @param parent_path   Path of parent relative to Diagnostics.  NULL or empty
+ *                      string means Diagnostics itself.
+ * @param name          BrowseName and DisplayName of the object.
+ */
+void
+diagnostics_add_object(UA_Server* server, const char* const parent_path, const char* const name) {
+    char parent[DIAGNOSTICS_PATH_MAX];
+    char path[DIAGNOSTICS_PATH_MAX];
+    if (parent_path == NULL || *parent_path == '\0') {
+        snprintf(parent, sizeof parent, DIAGNOSTICS_ROOT);
+    } else {
+        snprintf(parent, sizeof parent, DIAGNOSTICS_ROOT "/%s", parent_path);
+    }
+    snprintf(path, sizeof path, "%s/%s", parent, name);
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", (char*) name);
+    UA_StatusCode err = UA_Server_addObjectNode(server, UA_NODEID_STRING(DIAGNOSTICS_NS, path),
+                                                UA_NODEID_STRING(DIAGNOSTICS_NS, parent),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                UA_QUALIFIEDNAME(DIAGNOSTICS_NS, (char*) name),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+                                                attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/**
+ * Add read only scalar variable under diagnostics tree
+ *
+ * @param server        Pointer to UA_Server instance.
+ * @param parent_path   Path of parent object relative to Diagnostics.
+ * @param name          BrowseName and DisplayName of the variable.
+ * @param type          Data type of the variable.  Must be numeric or Boolean.
+ *                      Initial value is zero.
+ */
+void
+diagnostics_add_variable(UA_Server* server, const char* const parent_path, const char* const name,
+                         const UA_DataType* const type) {
+    char parent[DIAGNOSTICS_PATH_MAX];
+    char path[DIAGNOSTICS_PATH_MAX];
+    snprintf(parent, sizeof parent, DIAGNOSTICS_ROOT "/%s", parent_path);
+    snprintf(path, sizeof path, "%s/%s", parent, name);
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", (char*) name);
+    attr.dataType = type->typeId;
+    attr.valueRank = UA_VALUERANK_SCALAR;
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_Byte zero[sizeof(UA_UInt64)] = { 0 };
+    UA_Variant_setScalar(&attr.value, zero, type);
+    UA_StatusCode err = UA_Server_addVariableNode(server, UA_NODEID_STRING(DIAGNOSTICS_NS, path),
+                                                  UA_NODEID_STRING(DIAGNOSTICS_NS, parent),
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                  UA_QUALIFIEDNAME(DIAGNOSTICS_NS, (char*) name),
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                  attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/**
+ * Remove node from diagnostics tree together with its children
+ *
+ * @param server    Pointer to UA_Server instance.
+ * @param path      Path of the node relative to Diagnostics.
+ */
+void
+diagnostics_remove(UA_Server* server, const char* const path) {
+    char full_path[DIAGNOSTICS_PATH_MAX];
+    snprintf(full_path, sizeof full_path, DIAGNOSTICS_ROOT "/%s", path);
+    UA_StatusCode err = UA_Server_deleteNode(server, UA_NODEID_STRING(DIAGNOSTICS_NS, full_path), true);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/**
+ * Write value of diagnostics variable
+ *
+ * @param server    Pointer to UA_Server instance.
+ * @param path      Path of the variable relative to Diagnostics.
+ * @param value     Pointer to new value.
+ * @param type      Data type of the value.
+ */
+void
+diagnostics_write(UA_Server* server, const char* const path, const void* const value,
+                  const UA_DataType* const type) {
+    char full_path[DIAGNOSTICS_PATH_MAX];
+    snprintf(full_path, sizeof full_path, DIAGNOSTICS_ROOT "/%s", path);
+    UA_Variant v;
+    UA_Variant_setScalar(&v, (void*) value, type);
+    UA_StatusCode err = UA_Server_writeValue(server, UA_NODEID_STRING(DIAGNOSTICS_NS, full_path), v);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+void
+diagnostics_write_uint64(UA_Server* server, const char* const path, UA_UInt64 value) {
+    diagnostics_write(server, path, &value, &UA_TYPES[UA_TYPES_UINT64]);
+}
+
+/**
+ * Write bad status to diagnostics variable whose value can't be obtained
+ *
+ * @param server    Pointer to UA_Server instance.
+ * @param path      Path of the variable relative to Diagnostics.
+ * @param type      Data type of the variable.  Value is zero of it.
+ * @param status    Bad status code of the value.
+ */
+void
+diagnostics_write_status(UA_Server* server, const char* const path, const UA_DataType* const type,
+                         UA_StatusCode status) {
+    char full_path[DIAGNOSTICS_PATH_MAX];
+    snprintf(full_path, sizeof full_path, DIAGNOSTICS_ROOT "/%s", path);
+    UA_Byte zero[sizeof(UA_UInt64)] = { 0 };
+    UA_DataValue dv;
+    UA_DataValue_init(&dv);
+    UA_Variant_setScalar(&dv.value, zero, type);
+    dv.hasValue = true;
+    dv.status = status;
+    dv.hasStatus = true;
+    UA_StatusCode err = UA_Server_writeDataValue(server, UA_NODEID_STRING(DIAGNOSTICS_NS, full_path), dv);
+    assert(err == UA_STATUSCODE_GOOD);
+}
@@ -0,0 +1,16 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <open62541/server.h>
+
+#define DIAGNOSTICS_PATH_MAX 96
+
+void diagnostics_init(UA_Server* server);
+void diagnostics_add_object(UA_Server* server, const char* parent_path, const char* name);
+void diagnostics_add_variable(UA_Server* server, const char* parent_path, const char* name, const UA_DataType* type);
+void diagnostics_remove(UA_Server* server, const char* path);
+void diagnostics_write(UA_Server* server, const char* path, const void* value, const UA_DataType* type);
+void diagnostics_write_uint64(UA_Server* server, const char* path, UA_UInt64 value);
+void diagnostics_write_status(UA_Server* server, const char* path, const UA_DataType* type, UA_StatusCode status);
+
+#endif
@@ -0,0 +1,185 @@
+#include <assert.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <open62541/plugin/nodestore.h>
+#include <open62541/server.h>
+
+#include "diagnostics.h"
+#include "footprint.h"
+#include "log.h"
+
+/* Interval of updating RSS in diagnostics variables. */
+#define FOOTPRINT_UPDATE_INTERVAL_MS 5000
+
+static const char* const part_names[FOOTPRINT_PARTS] = {
+    [FOOTPRINT_NS0] = "ns0",
+    [FOOTPRINT_DI] = "DI",
+    [FOOTPRINT_PLC] = "PLCopen",
+    [FOOTPRINT_ROBOT] = "Robotics",
+    [FOOTPRINT_INSTANCES] = "Instances",
+};
+
+/**
+ * Current resident set size of this process in kilobytes
+ *
+ * Returns -1 when /proc/self/statm is not available.
+ */
+long
+footprint_rss_kb(void) {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long size, resident;
+    int n = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if (n != 2) {
+        return -1;
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Peak resident set size of this process in kilobytes. */
+long
+footprint_peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+/**
+ * Bytes of heap currently allocated by this process
+ *
+ * Memory consumed by a part of address space is measured as difference of this
+ * value before and after the part is created.  Only meaningful while other
+ * threads aren't allocating.
+ */
+size_t
+footprint_heap_bytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    struct mallinfo mi = mallinfo();
+    return (size_t) (unsigned int) mi.uordblks + (size_t) (unsigned int) mi.hblkhd;
+#endif
+}
+
+typedef struct {
+    size_t* counts;
+    size_t counts_size;
+} count_nodes_context_t;
+
+static void
+count_node(void* context, const UA_Node* node) {
+    count_nodes_context_t* c = context;
+    size_t ns = node->nodeId.namespaceIndex;
+    c->counts[ns < c->counts_size ? ns : c->counts_size - 1]++;
+}
+
+/**
+ * Count nodes in nodestore of the server per namespace
+ *
+ * @param server        Pointer to UA_Server instance.
+ * @param out_counts    Array where number of nodes in namespace i is written to
+ *                      out_counts[i].  Nodes in namespaces beyond the array are
+ *                      counted in the last element.
+ * @param counts_size   Number of elements of out_counts.
+ *
+ * Walks entire nodestore.  Must be called from the thread running the server.
+ */
+void
+footprint_count_nodes(UA_Server* server, size_t* out_counts, size_t counts_size) {
+    for (size_t i = 0; i < counts_size; i++) {
+        out_counts[i] = 0;
+    }
+    count_nodes_context_t c = { out_counts, counts_size };
+    UA_ServerConfig* config = UA_Server_getConfig(server);
+    config->nodestore.iterate(config->nodestore.context, count_node, &c);
+}
+
+void
+footprint_log_summary(const footprint_t* fp) {
+    size_t total_bytes = 0;
+    size_t total_nodes = 0;
+    for (int i = 0; i < FOOTPRINT_PARTS; i++) {
+        ULINFO("Footprint %-9s: %7zu nodes, %9zu bytes heap", part_names[i], fp->nodes[i], fp->heap_bytes[i]);
+        total_bytes += fp->heap_bytes[i];
+        total_nodes += fp->nodes[i];
+    }
+    ULINFO("Footprint total    : %7zu nodes, %9zu bytes heap", total_nodes, total_bytes);
+    for (int i = 0; i < MAX_ROBOTS; i++) {
+        if (fp->motion_device_heap_bytes[i] == 0) {
+            continue;   /* Not instantiated in this address space */
+        }
+        ULINFO("Footprint Robot%d   : %9zu bytes heap", i + 1, fp->motion_device_heap_bytes[i]);
+    }
+    ULINFO("Footprint RSS: startup %ld kB, current %ld kB, peak %ld kB",
+        fp->startup_rss_kb, footprint_rss_kb(), footprint_peak_rss_kb());
+}
+
+/* Write RSS in bytes, or bad status if it couldn't be read. */
+static void
+write_rss(UA_Server* server, const char* path, long kb) {
+    if (kb < 0) {
+        diagnostics_write_status(server, path, &UA_TYPES[UA_TYPES_UINT64], UA_STATUSCODE_BADRESOURCEUNAVAILABLE);
+        return;
+    }
+    diagnostics_write_uint64(server, path, (UA_UInt64) kb * 1024);
+}
+
+static void
+update_rss(UA_Server* server, void* data) {
+    write_rss(server, "Footprint/RssBytes", footprint_rss_kb());
+    write_rss(server, "Footprint/PeakRssBytes", footprint_peak_rss_kb());
+}
+
+/**
+ * Expose footprint as diagnostics variables
+ *
+ * Creates Diagnostics/Footprint with heap bytes and node count of each part of
+ * address space, heap bytes of each motion device in the address space, and
+ * RSS of the process.  RSS which can't be read has bad status instead.
+ * Startup values are written once.  Current and peak RSS are updated
+ * periodically so that steady state RSS can be observed.
+ */
+void
+footprint_add_diagnostics(UA_Server* server, const footprint_t* fp) {
+    char path[DIAGNOSTICS_PATH_MAX];
+    diagnostics_add_object(server, NULL, "Footprint");
+    diagnostics_add_variable(server, "Footprint", "StartupRssBytes", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, "Footprint", "RssBytes", &UA_TYPES[UA_TYPES_UINT64]);
+    diagnostics_add_variable(server, "Footprint", "PeakRssBytes", &UA_TYPES[UA_TYPES_UINT64]);
+    write_rss(server, "Footprint/StartupRssBytes", fp->startup_rss_kb);
+    diagnostics_add_object(server, "Footprint", "Namespaces");
+    for (int i = 0; i < FOOTPRINT_PARTS; i++) {
+        diagnostics_add_object(server, "Footprint/Namespaces", part_names[i]);
+        snprintf(path, sizeof path, "Footprint/Namespaces/%s", part_names[i]);
+        diagnostics_add_variable(server, path, "HeapBytes", &UA_TYPES[UA_TYPES_UINT64]);
+        diagnostics_add_variable(server, path, "NodeCount", &UA_TYPES[UA_TYPES_UINT64]);
+        snprintf(path, sizeof path, "Footprint/Namespaces/%s/HeapBytes", part_names[i]);
+        diagnostics_write_uint64(server, path, fp->heap_bytes[i]);
+        snprintf(path, sizeof path, "Footprint/Namespaces/%s/NodeCount", part_names[i]);
+        diagnostics_write_uint64(server, path, fp->nodes[i]);
+    }
+    diagnostics_add_object(server, "Footprint", "MotionDevices");
+    for (int i = 0; i < MAX_ROBOTS; i++) {
+        if (fp->motion_device_heap_bytes[i] == 0) {
+            continue;
+        }
+        char robot_name[20];
+        snprintf(robot_name, sizeof robot_name, "Robot%d", i + 1);
+        diagnostics_add_object(server, "Footprint/MotionDevices", robot_name);
+        snprintf(path, sizeof path, "Footprint/MotionDevices/%s", robot_name);
+        diagnostics_add_variable(server, path, "HeapBytes", &UA_TYPES[UA_TYPES_UINT64]);
+        snprintf(path, sizeof path, "Footprint/MotionDevices/%s/HeapBytes", robot_name);
+        diagnostics_write_uint64(server, path, fp->motion_device_heap_bytes[i]);
+    }
+    update_rss(server, NULL);
+    UA_StatusCode err = UA_Server_addRepeatedCallback(server, update_rss, NULL, FOOTPRINT_UPDATE_INTERVAL_MS, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
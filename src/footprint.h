@@ -0,0 +1,18 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <stddef.h>
+#include <open62541/server.h>
+
+#include "context.h"
+
+#define FOOTPRINT_MAX_NAMESPACES 8
+
+long footprint_rss_kb(void);
+long footprint_peak_rss_kb(void);
+size_t footprint_heap_bytes(void);
+void footprint_count_nodes(UA_Server* server, size_t* out_counts, size_t counts_size);
+void footprint_log_summary(const footprint_t* fp);
+void footprint_add_diagnostics(UA_Server* server, const footprint_t* fp);
+
+#endif
@@ -0,0 +1,319 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAME_X86 1
+#endif
+
+#include "frame.h"
+#include "frame_schema_generated.h"
+#include "log.h"
+#include "snapshot.h"
+
+/* Number of frames decoded by each implementation in frame_decoder_benchmark(). */
+#define BENCHMARK_FRAMES 200000
+
+/* Default schema is generated from tagmap/robot_frame.csv at build time. */
+static const frame_block_t default_blocks[] = {
+    FRAME_SCHEMA_BLOCKS
+};
+
+const frame_schema_t frame_default_schema = {
+    .blocks_size = sizeof default_blocks / sizeof default_blocks[0],
+    .blocks = default_blocks,
+};
+
+/*
+ * Decoder of one block.  Converts n big endian 32bit values at src to float,
+ * multiplies by scale, and stores them to dst.
+ */
+typedef void (*block_decoder_t)(float* restrict dst, const uint8_t* restrict src, size_t n, float scale);
+
+typedef struct {
+    const char* name;
+    bool (*supported)(void);    /* Whether the CPU runs the implementation */
+    block_decoder_t be_float32;
+    block_decoder_t be_int32;
+} decoder_impl_t;
+
+static inline uint32_t
+load_be32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return ntohl(v);
+}
+
+static void
+decode_be_float32_scalar(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits = load_be32(src + i * 4);
+        float v;
+        memcpy(&v, &bits, sizeof v);
+        dst[i] = v * scale;
+    }
+}
+
+static void
+decode_be_int32_scalar(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (float) (int32_t) load_be32(src + i * 4) * scale;
+    }
+}
+
+static bool
+supported_always(void) {
+    return true;
+}
+
+#ifdef FRAME_X86
+static bool
+supported_ssse3(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static bool
+supported_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * SSSE3 decoders swap bytes of four values at once with pshufb.  Values left
+ * over are decoded by scalar code.
+ */
+__attribute__((target("ssse3")))
+static void
+decode_be_float32_ssse3(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128 vscale = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + i * 4)), bswap);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_castsi128_ps(v), vscale));
+    }
+    decode_be_float32_scalar(dst + i, src + i * 4, n - i, scale);
+}
+
+__attribute__((target("ssse3")))
+static void
+decode_be_int32_ssse3(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128 vscale = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + i * 4)), bswap);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), vscale));
+    }
+    decode_be_int32_scalar(dst + i, src + i * 4, n - i, scale);
+}
+
+/*
+ * AVX2 decoders handle eight values at once.  The rest, which is the entire
+ * block when a robot has eight axes or fewer, is done in one more step with
+ * masked load and store so that no byte beyond the block is touched.
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+tail_mask_avx2(size_t n) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32((int) n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2")))
+static void
+decode_be_float32_avx2(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256 vscale = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) (src + i * 4)), bswap);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_castsi256_ps(v), vscale));
+    }
+    if (i < n) {
+        const __m256i mask = tail_mask_avx2(n - i);
+        __m256i v = _mm256_shuffle_epi8(_mm256_maskload_epi32((const int*) (src + i * 4), mask), bswap);
+        _mm256_maskstore_ps(dst + i, mask, _mm256_mul_ps(_mm256_castsi256_ps(v), vscale));
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+decode_be_int32_avx2(float* restrict dst, const uint8_t* restrict src, size_t n, float scale) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256 vscale = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) (src + i * 4)), bswap);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vscale));
+    }
+    if (i < n) {
+        const __m256i mask = tail_mask_avx2(n - i);
+        __m256i v = _mm256_shuffle_epi8(_mm256_maskload_epi32((const int*) (src + i * 4), mask), bswap);
+        _mm256_maskstore_ps(dst + i, mask, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vscale));
+    }
+}
+#endif
+
+/* Implementations in order of preference. */
+static const decoder_impl_t impls[] = {
+#ifdef FRAME_X86
+    { "avx2", supported_avx2, decode_be_float32_avx2, decode_be_int32_avx2 },
+    { "ssse3", supported_ssse3, decode_be_float32_ssse3, decode_be_int32_ssse3 },
+#endif
+    { "scalar", supported_always, decode_be_float32_scalar, decode_be_int32_scalar },
+};
+#define IMPLS_SIZE (sizeof impls / sizeof impls[0])
+
+static const decoder_impl_t* decoder = &impls[IMPLS_SIZE - 1];
+
+/* Total size of a frame in bytes including length field. */
+size_t
+frame_size(const frame_schema_t* schema, size_t axes) {
+    return FRAME_HEADER_SIZE + schema->blocks_size * axes * 4;
+}
+
+/**
+ * Validate header of a frame of the default schema
+ *
+ * @param frame         Frame starting with its length field.
+ * @param len           Total length of the frame in bytes including length field.
+ * @param out_sequence  Sequence number of the frame.
+ *
+ * Returns robot ID of the frame or -1 if frame is malformed.
+ */
+int
+frame_check(const uint8_t* frame, size_t len, uint32_t* out_sequence) {
+    if (len < FRAME_HEADER_SIZE) {
+        return -1;
+    }
+    const int robot = frame[4] << 8 | frame[5];
+    const size_t axes = frame[6] << 8 | frame[7];
+    if (MAX_ROBOTS <= robot || MAX_AXES < axes || len != frame_size(&frame_default_schema, axes)) {
+        return -1;
+    }
+    *out_sequence = load_be32(frame + 8);
+    return robot;
+}
+
+/**
+ * Decode a frame of the default schema into snapshot
+ *
+ * @param frame     Frame starting with its length field.
+ * @param len       Total length of the frame in bytes including length field.
+ * @param now_ns    uv_hrtime() when the frame arrived.
+ * @param snap      Snapshot where values of the robot in the frame are written.
+ *
+ * Returns robot ID of the frame or -1 if frame is malformed.  Snapshot is not
+ * touched when frame is malformed.
+ */
+int
+frame_decode(const uint8_t* frame, size_t len, uint64_t now_ns, snapshot_t* snap) {
+    uint32_t sequence;
+    const int robot = frame_check(frame, len, &sequence);
+    if (robot < 0) {
+        return -1;
+    }
+    const size_t axes = frame[6] << 8 | frame[7];
+    const uint8_t* block = frame + FRAME_HEADER_SIZE;
+    snapshot_write_begin(snap, robot);
+    frame_schema_decode(decoder->be_float32, decoder->be_int32, block, axes, robot, snap);
+    snap->sequence[robot] = sequence;
+    snap->timestamp_ns[robot] = now_ns;
+    atomic_store_explicit(&snap->live[robot], true, memory_order_release);
+    snapshot_write_end(snap, robot);
+    return robot;
+}
+
+/*
+ * Build a frame of the default schema carrying values in the range devices
+ * send, so that timing isn't skewed by NaN or denormal floats.
+ */
+static void
+build_benchmark_frame(uint8_t* frame, size_t len, int robot) {
+    memset(frame, 0, len);
+    uint32_t be = htonl((uint32_t) (len - FRAME_LENGTH_SIZE));
+    memcpy(frame, &be, sizeof be);
+    frame[5] = (uint8_t) robot;
+    frame[7] = MAX_AXES;
+    uint8_t* block = frame + FRAME_HEADER_SIZE;
+    for (size_t b = 0; b < frame_default_schema.blocks_size; b++) {
+        const frame_block_t* blk = &frame_default_schema.blocks[b];
+        for (int j = 0; j < MAX_AXES; j++) {
+            /* About 12.3 to 87.6 units in each field after scaling. */
+            const float value = 12.3f + 15.0f * j + robot;
+            uint32_t raw;
+            if (blk->encoding == FRAME_BE_FLOAT32) {
+                const float f = value / blk->scale;
+                memcpy(&raw, &f, sizeof raw);
+            } else {
+                raw = (uint32_t) (int32_t) (value / blk->scale);
+            }
+            be = htonl(raw);
+            memcpy(block + j * 4, &be, sizeof be);
+        }
+        block += MAX_AXES * 4;
+    }
+}
+
+static double
+elapsed_sec(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Select frame decoder implementation
+ *
+ * Picks the most preferred implementation the CPU supports.  Must be called
+ * before any frame is decoded.
+ */
+void
+frame_decoder_select(void) {
+    for (size_t i = 0; i < IMPLS_SIZE; i++) {
+        if (impls[i].supported()) {
+            decoder = &impls[i];
+            break;
+        }
+        ULINFO("Frame decoder %s: not supported by CPU", impls[i].name);
+    }
+    ULINFO("Frame decoder %s selected.", decoder->name);
+}
+
+/**
+ * Measure throughput of frame decoder implementations
+ *
+ * Every implementation the CPU supports decodes frames of the default schema
+ * and its throughput is logged, so that the gain of vectorized decoding is
+ * visible on the box it runs on.  Selected implementation is kept.  Must be
+ * called after frame_decoder_select() and before any frame is decoded.
+ */
+void
+frame_decoder_benchmark(void) {
+    static uint8_t frames[MAX_ROBOTS][FRAME_HEADER_SIZE + AXIS_FIELDS * MAX_AXES * 4];
+    static snapshot_t snap;
+    const size_t len = frame_size(&frame_default_schema, MAX_AXES);
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        build_benchmark_frame(frames[r], len, r);
+    }
+    const decoder_impl_t* selected = decoder;
+    for (size_t i = 0; i < IMPLS_SIZE; i++) {
+        if (!impls[i].supported()) {
+            continue;
+        }
+        decoder = &impls[i];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int n = 0; n < BENCHMARK_FRAMES; n++) {
+            frame_decode(frames[n % MAX_ROBOTS], len, 0, &snap);
+        }
+        double sec = elapsed_sec(&start);
+        ULINFO("Frame decoder %s: %.0f frames/s, %.1f M values/s", impls[i].name,
+            BENCHMARK_FRAMES / sec, BENCHMARK_FRAMES * frame_default_schema.blocks_size * MAX_AXES / sec / 1e6);
+    }
+    decoder = selected;
+}
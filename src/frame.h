@@ -0,0 +1,52 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "context.h"
+
+/*
+ * Device frame
+ *
+ * All integers and floats are big endian.
+ *
+ *   offset  size  field
+ *   0       4     length of the frame excluding this field
+ *   4       2     robot ID, 0 origin
+ *   6       2     number of axes N in each block, up to MAX_AXES
+ *   8       4     sequence number
+ *   12      4*N   first block of the schema
+ *   ...           following blocks of the schema, 4*N bytes each
+ *
+ * A block carries one field of all axes of the robot.  Which field each block
+ * carries and how it is encoded is defined by frame_schema_t.
+ */
+#define FRAME_LENGTH_SIZE 4
+#define FRAME_HEADER_SIZE 12
+
+typedef enum {
+    FRAME_BE_FLOAT32,   /* IEEE 754 single, multiplied by scale */
+    FRAME_BE_INT32,     /* Two's complement, converted to float and multiplied by scale */
+} frame_encoding_t;
+
+typedef struct {
+    int field;          /* AXIS_POSITION etc. */
+    frame_encoding_t encoding;
+    float scale;
+} frame_block_t;
+
+typedef struct {
+    size_t blocks_size;
+    const frame_block_t* blocks;
+} frame_schema_t;
+
+extern const frame_schema_t frame_default_schema;
+
+void frame_decoder_select(void);
+void frame_decoder_benchmark(void);
+size_t frame_size(const frame_schema_t* schema, size_t axes);
+int frame_check(const uint8_t* frame, size_t len, uint32_t* out_sequence);
+int frame_decode(const uint8_t* frame, size_t len, uint64_t now_ns, snapshot_t* snap);
+
+#endif
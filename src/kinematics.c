@@ -0,0 +1,319 @@
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "kinematics.h"
+#include "log.h"
+#include "snapshot.h"
+
+/*
+ * Robots computed together by one worker, one per lane of a 128-bit vector.
+ * Sine, cosine and the joint transform chain of a batch are computed with
+ * GCC vector extensions, which compile to SSE on x86-64 and NEON on AArch64
+ * at any optimization level.  Only the final Euler angles are per lane.
+ */
+#define KINEMATICS_LANES 4
+#define KINEMATICS_BATCHES ((MAX_ROBOTS + KINEMATICS_LANES - 1) / KINEMATICS_LANES)
+/* More workers than batches would have nothing to compute. */
+#define KINEMATICS_MAX_WORKERS KINEMATICS_BATCHES
+
+typedef float lanes_t __attribute__((vector_size(KINEMATICS_LANES * sizeof(float))));
+typedef int32_t ilanes_t __attribute__((vector_size(KINEMATICS_LANES * sizeof(int32_t))));
+
+/* Number of batches computed in the startup benchmark.  See [system] benchmark. */
+#define BENCHMARK_BATCHES 20000
+
+#define DEG_TO_RAD ((float) (M_PI / 180.0))
+
+/*
+ * Forward kinematics worker pool
+ *
+ * The async loop kicks the pool after new frames are decoded.  A round
+ * computes TCP pose of every robot from the snapshot, one batch per worker at a
+ * time.  Kicks arriving during a round are merged into one more round which
+ * starts after every batch of the current round finished, so a robot's pose is
+ * never written by two workers at once.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t threads[KINEMATICS_MAX_WORKERS];
+    atomic_int workers;     /* Set once workers are running */
+    bool requested;     /* Kicked since current round started */
+    bool stopping;
+    int next_batch;     /* Next batch to be claimed in current round */
+    int running;        /* Batches being computed */
+    app_context_t* ctx;
+    float a[MAX_AXES];
+    float d[MAX_AXES];
+    float cos_alpha[MAX_AXES];
+    float sin_alpha[MAX_AXES];
+    float theta_offset[MAX_AXES];   /* Radians */
+    double pose[MAX_ROBOTS][POSE_SIZE];
+    atomic_uint pose_lock[MAX_ROBOTS];
+} kinematics_t;
+
+static kinematics_t kin = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .next_batch = KINEMATICS_BATCHES,
+};
+
+/**
+ * Compute sine and cosine of each lane
+ *
+ * Reduces x to [-pi/4, pi/4] by its nearest multiple of pi/2 and evaluates the
+ * minimax polynomials of Cephes sinf/cosf there, which is accurate to a few
+ * ulp for joint angles.  The quadrant then swaps and negates the results.
+ */
+static void
+sincos_lanes(lanes_t x, lanes_t* out_sin, lanes_t* out_cos) {
+    const lanes_t qf = x * (float) (2.0 / M_PI) + 0.5f;
+    ilanes_t q = __builtin_convertvector(qf, ilanes_t);
+    q += qf < __builtin_convertvector(q, lanes_t);      /* Truncation to floor; true is -1 */
+    const lanes_t qq = __builtin_convertvector(q, lanes_t);
+    const lanes_t r = (x - qq * 1.5707963705062866f) - qq * -4.371139000186243e-08f;
+    const lanes_t z = r * r;
+    const lanes_t s = r + r * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f));
+    const lanes_t c = 1.0f - 0.5f * z
+        + z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f + z * 2.443315711809948e-5f));
+    const ilanes_t swap = -(q & 1);
+    const ilanes_t si = ((ilanes_t) s & ~swap) | ((ilanes_t) c & swap);
+    const ilanes_t ci = ((ilanes_t) c & ~swap) | ((ilanes_t) s & swap);
+    *out_sin = (lanes_t) (si ^ ((q & 2) << 30));
+    *out_cos = (lanes_t) (ci ^ (((q + 1) & 2) << 30));
+}
+
+/**
+ * Compute TCP pose of a batch of robots
+ *
+ * @param k         DH parameters.
+ * @param theta     Joint positions in degrees, [axis][lane].
+ * @param out_pose  TCP poses, [element][lane].
+ */
+static void
+compute_batch(const kinematics_t* k, const float theta[MAX_AXES][KINEMATICS_LANES],
+              float out_pose[POSE_SIZE][KINEMATICS_LANES]) {
+    lanes_t r[3][3];
+    lanes_t p[3];
+    for (int i = 0; i < 3; i++) {
+        for (int c = 0; c < 3; c++) {
+            r[i][c] = (lanes_t) { 0 } + (float) (i == c);
+        }
+        p[i] = (lanes_t) { 0 };
+    }
+    for (int j = 0; j < MAX_AXES; j++) {
+        lanes_t t;
+        memcpy(&t, theta[j], sizeof t);
+        lanes_t ct, st;
+        sincos_lanes(t * DEG_TO_RAD + k->theta_offset[j], &st, &ct);
+        /*
+         * Post-multiply by joint transform
+         *
+         *   | ct  -st*ca   st*sa  a*ct |
+         *   | st   ct*ca  -ct*sa  a*st |
+         *   | 0    sa      ca     d    |
+         */
+        const float a = k->a[j];
+        const float d = k->d[j];
+        const float ca = k->cos_alpha[j];
+        const float sa = k->sin_alpha[j];
+        for (int i = 0; i < 3; i++) {
+            const lanes_t r0 = r[i][0];
+            const lanes_t r1 = r[i][1];
+            const lanes_t r2 = r[i][2];
+            r[i][0] = r0 * ct + r1 * st;
+            r[i][1] = (r1 * ct - r0 * st) * ca + r2 * sa;
+            r[i][2] = (r0 * st - r1 * ct) * sa + r2 * ca;
+            p[i] += (r0 * ct + r1 * st) * a + r2 * d;
+        }
+    }
+    memcpy(out_pose[0], &p[0], sizeof p[0]);
+    memcpy(out_pose[1], &p[1], sizeof p[1]);
+    memcpy(out_pose[2], &p[2], sizeof p[2]);
+    /* No vector atan2 is at hand, so Euler angles are computed lane by lane. */
+    for (int l = 0; l < KINEMATICS_LANES; l++) {
+        out_pose[3][l] = atan2f(r[2][1][l], r[2][2][l]) / DEG_TO_RAD;
+        out_pose[4][l] = atan2f(-r[2][0][l], sqrtf(r[2][1][l] * r[2][1][l] + r[2][2][l] * r[2][2][l])) / DEG_TO_RAD;
+        out_pose[5][l] = atan2f(r[1][0][l], r[0][0][l]) / DEG_TO_RAD;
+    }
+}
+
+static void
+run_batch(kinematics_t* k, int batch) {
+    float theta[MAX_AXES][KINEMATICS_LANES] = { { 0 } };
+    float pose[POSE_SIZE][KINEMATICS_LANES];
+    bool valid[KINEMATICS_LANES] = { false };
+    const int first = batch * KINEMATICS_LANES;
+    for (int l = 0; l < KINEMATICS_LANES && first + l < MAX_ROBOTS; l++) {
+        float values[AXIS_FIELDS][MAX_AXES];
+        uint32_t sequence;
+        /* Once live is seen, values read are of a frame, not restored ones. */
+        valid[l] = atomic_load_explicit(&k->ctx->snapshot.live[first + l], memory_order_acquire);
+        snapshot_read(&k->ctx->snapshot, first + l, values, &sequence);
+        for (int j = 0; j < MAX_AXES; j++) {
+            theta[j][l] = values[AXIS_POSITION][j];
+        }
+    }
+    compute_batch(k, theta, pose);
+    for (int l = 0; l < KINEMATICS_LANES && first + l < MAX_ROBOTS; l++) {
+        if (!valid[l]) {
+            continue;
+        }
+        const int robot = first + l;
+        unsigned int v = atomic_load_explicit(&k->pose_lock[robot], memory_order_relaxed);
+        atomic_store_explicit(&k->pose_lock[robot], v + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (int e = 0; e < POSE_SIZE; e++) {
+            k->pose[robot][e] = pose[e][l];
+        }
+        atomic_store_explicit(&k->pose_lock[robot], v + 2, memory_order_release);
+    }
+}
+
+static void*
+worker_main(void* arg) {
+    kinematics_t* k = arg;
+    pthread_mutex_lock(&k->lock);
+    for (;;) {
+        while (!k->stopping && KINEMATICS_BATCHES <= k->next_batch && !(k->requested && k->running == 0)) {
+            pthread_cond_wait(&k->cond, &k->lock);
+        }
+        if (k->stopping) {
+            break;
+        }
+        if (KINEMATICS_BATCHES <= k->next_batch) {
+            /* Start new round. */
+            k->requested = false;
+            k->next_batch = 0;
+        }
+        const int batch = k->next_batch++;
+        k->running++;
+        if (k->next_batch < KINEMATICS_BATCHES) {
+            pthread_cond_signal(&k->cond);
+        }
+        pthread_mutex_unlock(&k->lock);
+        run_batch(k, batch);
+        pthread_mutex_lock(&k->lock);
+        k->running--;
+        if (k->running == 0 && k->requested) {
+            pthread_cond_signal(&k->cond);
+        }
+    }
+    pthread_mutex_unlock(&k->lock);
+    return NULL;
+}
+
+/* Measure single core throughput of compute_batch() and log it. */
+static void
+benchmark(const kinematics_t* k) {
+    float theta[MAX_AXES][KINEMATICS_LANES];
+    float pose[POSE_SIZE][KINEMATICS_LANES];
+    for (int j = 0; j < MAX_AXES; j++) {
+        for (int l = 0; l < KINEMATICS_LANES; l++) {
+            theta[j][l] = (float) (j * 10 + l);
+        }
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    for (int n = 0; n < BENCHMARK_BATCHES; n++) {
+        theta[0][0] = (float) n;
+        compute_batch(k, theta, pose);
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    double sec = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    ULINFO("Forward kinematics: %.0f poses/s per core (%d axes, %d lanes)",
+        BENCHMARK_BATCHES * KINEMATICS_LANES / sec, MAX_AXES, KINEMATICS_LANES);
+}
+
+/**
+ * Start forward kinematics worker pool
+ *
+ * Creates conf.kinematics.workers threads, separate from the async loop and
+ * server threads.  Does nothing when it is 0.  May be called while the async
+ * loop is already decoding frames.
+ */
+void
+kinematics_start(app_context_t* ctx) {
+    const kinematics_conf_t* conf = &ctx->conf.kinematics;
+    if (conf->workers <= 0) {
+        return;
+    }
+    kinematics_t* k = &kin;
+    k->ctx = ctx;
+    for (int j = 0; j < MAX_AXES; j++) {
+        k->a[j] = (float) conf->dh[DH_A][j];
+        k->d[j] = (float) conf->dh[DH_D][j];
+        k->cos_alpha[j] = (float) cos(conf->dh[DH_ALPHA][j] * M_PI / 180.0);
+        k->sin_alpha[j] = (float) sin(conf->dh[DH_ALPHA][j] * M_PI / 180.0);
+        k->theta_offset[j] = (float) (conf->dh[DH_THETA_OFFSET][j] * M_PI / 180.0);
+    }
+    if (ctx->conf.system.benchmark) {
+        benchmark(k);
+    }
+    int workers = conf->workers;
+    if (KINEMATICS_MAX_WORKERS < workers) {
+        ULINFO("Forward kinematics: %d workers requested but only %d batches of %d robots to share.",
+            workers, KINEMATICS_BATCHES, KINEMATICS_LANES);
+        workers = KINEMATICS_MAX_WORKERS;
+    }
+    for (int i = 0; i < workers; i++) {
+        int err = pthread_create(&k->threads[i], NULL, worker_main, k);
+        assert(err == 0);
+    }
+    /* Kicks before this are ignored; the next frame kicks again. */
+    atomic_store_explicit(&k->workers, workers, memory_order_release);
+    ULINFO("Forward kinematics: %d workers started.", workers);
+}
+
+void
+kinematics_stop(void) {
+    kinematics_t* k = &kin;
+    pthread_mutex_lock(&k->lock);
+    k->stopping = true;
+    pthread_cond_broadcast(&k->cond);
+    pthread_mutex_unlock(&k->lock);
+    const int workers = atomic_load(&k->workers);
+    for (int i = 0; i < workers; i++) {
+        pthread_join(k->threads[i], NULL);
+    }
+    atomic_store(&k->workers, 0);
+}
+
+/* Request a round of computation.  Called after new frames are decoded. */
+void
+kinematics_kick(void) {
+    kinematics_t* k = &kin;
+    if (atomic_load_explicit(&k->workers, memory_order_acquire) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&k->lock);
+    k->requested = true;
+    pthread_cond_signal(&k->cond);
+    pthread_mutex_unlock(&k->lock);
+}
+
+/**
+ * Read TCP pose of a robot
+ *
+ * Returns lock value the pose was read at.  0 means pose of the robot is not
+ * computed yet.  Value changes every time pose is updated.
+ */
+unsigned int
+kinematics_read_pose(int robot, double out_pose[POSE_SIZE]) {
+    kinematics_t* k = &kin;
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&k->pose_lock[robot], memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out_pose, k->pose[robot], sizeof k->pose[robot]);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&k->pose_lock[robot], memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return before;
+}
@@ -0,0 +1,14 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include "context.h"
+
+/* TCP pose: x, y, z in meters then roll, pitch, yaw (ZYX Euler) in degrees. */
+#define POSE_SIZE 6
+
+void kinematics_start(app_context_t* ctx);
+void kinematics_stop(void);
+void kinematics_kick(void);
+unsigned int kinematics_read_pose(int robot, double out_pose[POSE_SIZE]);
+
+#endif
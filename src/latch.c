@@ -0,0 +1,42 @@
+#include <assert.h>
+
+#include "latch.h"
+
+void
+latch_init(latch_t* latch, int count) {
+    assert(0 <= count);
+    int err = pthread_mutex_init(&latch->lock, NULL);
+    assert(err == 0);
+    err = pthread_cond_init(&latch->open_cond, NULL);
+    assert(err == 0);
+    latch->count = count;
+}
+
+/* Report one party ready.  The last one wakes every waiter up. */
+void
+latch_count_down(latch_t* latch) {
+    int err = pthread_mutex_lock(&latch->lock);
+    assert(err == 0);
+    assert(0 < latch->count);
+    if (--latch->count == 0) {
+        pthread_cond_broadcast(&latch->open_cond);
+    }
+    pthread_mutex_unlock(&latch->lock);
+}
+
+/* Wait until every party reported ready.  Returns immediately if already open. */
+void
+latch_wait(latch_t* latch) {
+    int err = pthread_mutex_lock(&latch->lock);
+    assert(err == 0);
+    while (latch->count != 0) {
+        pthread_cond_wait(&latch->open_cond, &latch->lock);
+    }
+    pthread_mutex_unlock(&latch->lock);
+}
+
+void
+latch_destroy(latch_t* latch) {
+    pthread_cond_destroy(&latch->open_cond);
+    pthread_mutex_destroy(&latch->lock);
+}
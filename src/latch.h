@@ -0,0 +1,24 @@
+#ifndef LATCH_H
+#define LATCH_H
+
+#include <pthread.h>
+
+/*
+ * Counted latch
+ *
+ * Opens when it is counted down as many times as given at initialization.
+ * Any number of parties report readiness to it and any number of threads wait
+ * for all of them.  Once open it stays open.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t open_cond;
+    int count;
+} latch_t;
+
+void latch_init(latch_t* latch, int count);
+void latch_count_down(latch_t* latch);
+void latch_wait(latch_t* latch);
+void latch_destroy(latch_t* latch);
+
+#endif
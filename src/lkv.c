@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "lkv.h"
+#include "log.h"
+#include "snapshot.h"
+
+/*
+ * Last known value file
+ *
+ * Values of every robot in snapshot are written behind into a file mapped to
+ * memory by a timer on the async loop, the writer of snapshot, so decoding
+ * frames does no extra work.  Pages are left to the kernel to write back, so
+ * the file survives restart and crash of the process, not of the host.
+ *
+ * At startup values in the file are put into snapshot before servers run.
+ * They are published with status UncertainLastUsableValue and their original
+ * source timestamp until the first frame of the robot arrives.  Alarms,
+ * aggregates and forward kinematics ignore them since snapshot.live of the
+ * robot stays false until then.
+ */
+
+#define LKV_MAGIC "OPCUALKV"
+#define LKV_VERSION 1
+
+typedef struct {
+    atomic_uint lock;           /* Odd while the record is being written.  See flush(). */
+    uint32_t sequence;
+    int64_t source_time;        /* UA_DateTime the frame arrived at.  0 if never written. */
+    float value[AXIS_FIELDS][MAX_AXES];
+} lkv_record_t;
+
+/* Shape of the file.  A file of different shape is discarded. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t robots;
+    uint32_t axes;
+    uint32_t fields;
+    lkv_record_t records[MAX_ROBOTS];
+} lkv_file_t;
+
+static bool
+same_shape(const lkv_file_t* file) {
+    return memcmp(file->magic, LKV_MAGIC, sizeof file->magic) == 0 && file->version == LKV_VERSION
+        && file->robots == MAX_ROBOTS && file->axes == MAX_AXES && file->fields == AXIS_FIELDS;
+}
+
+/**
+ * Map last known value file
+ *
+ * File given by conf.system.lkv_path is created or resized as needed.
+ * Returns 0 on success or when it is disabled.  On failure the process runs
+ * without it.
+ */
+int
+lkv_open(app_context_t* ctx) {
+    lkv_t* lkv = &ctx->lkv;
+    const char* path = ctx->conf.system.lkv_path;
+    if (*path == '\0') {
+        return 0;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        SYSERR(path, errno);
+        return 1;
+    }
+    const size_t size = sizeof(lkv_file_t);
+    off_t old_size = lseek(fd, 0, SEEK_END);
+    if ((size_t) old_size != size && ftruncate(fd, size) != 0) {
+        SYSERR("ftruncate", errno);
+        close(fd);
+        return 1;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SYSERR("mmap", errno);
+        return 1;
+    }
+    lkv_file_t* file = map;
+    if ((size_t) old_size != size || !same_shape(file)) {
+        if (old_size != 0) {
+            ULINFO("Last known values in %s discarded.  They were saved by a build of different shape.", path);
+        }
+        memset(file, 0, size);
+        memcpy(file->magic, LKV_MAGIC, sizeof file->magic);
+        file->version = LKV_VERSION;
+        file->robots = MAX_ROBOTS;
+        file->axes = MAX_AXES;
+        file->fields = AXIS_FIELDS;
+    }
+    lkv->map = map;
+    lkv->size = size;
+    return 0;
+}
+
+/**
+ * Put last known values into snapshot
+ *
+ * Must be called before the async loop starts.  Records torn by a crash while
+ * they were being written are skipped.
+ */
+void
+lkv_restore(app_context_t* ctx) {
+    const lkv_file_t* file = ctx->lkv.map;
+    if (file == NULL) {
+        return;
+    }
+    int restored = 0;
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        const lkv_record_t* rec = &file->records[r];
+        if ((atomic_load_explicit(&rec->lock, memory_order_acquire) & 1) || rec->source_time == 0) {
+            continue;
+        }
+        snapshot_write_begin(&ctx->snapshot, r);
+        for (int f = 0; f < AXIS_FIELDS; f++) {
+            memcpy(ctx->snapshot.value[f][r], rec->value[f], sizeof rec->value[f]);
+        }
+        ctx->snapshot.sequence[r] = rec->sequence;
+        snapshot_write_end(&ctx->snapshot, r);
+        robot_nodes_t* nodes = &ctx->robot_nodes[r];
+        nodes->restored_version = atomic_load_explicit(&ctx->snapshot.lock[r], memory_order_relaxed);
+        nodes->restored_time = rec->source_time;
+        ctx->lkv.flushed_version[r] = nodes->restored_version;
+        restored++;
+    }
+    ULINFO("Last known values of %d robots restored from %s.", restored, ctx->conf.system.lkv_path);
+}
+
+/*
+ * Write values of robots updated since previous call into the file.  Lock of
+ * a record is bumped before and after it is written the same way as snapshot
+ * lock, so that a record torn by a crash is odd in the file.  Writing starts
+ * from the lock rounded up to odd, which repairs the parity of a record left
+ * odd by a crash.
+ */
+static void
+flush(lkv_t* lkv, const snapshot_t* snap) {
+    lkv_file_t* file = lkv->map;
+    const uint64_t now_ns = uv_hrtime();
+    const UA_DateTime now = UA_DateTime_now();
+    for (int r = 0; r < MAX_ROBOTS; r++) {
+        const unsigned int version = atomic_load_explicit(&snap->lock[r], memory_order_relaxed);
+        if (version == lkv->flushed_version[r]) {
+            continue;
+        }
+        lkv->flushed_version[r] = version;
+        lkv_record_t* rec = &file->records[r];
+        const unsigned int lock = atomic_load_explicit(&rec->lock, memory_order_relaxed) | 1;
+        atomic_store_explicit(&rec->lock, lock, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (int f = 0; f < AXIS_FIELDS; f++) {
+            memcpy(rec->value[f], snap->value[f][r], sizeof rec->value[f]);
+        }
+        rec->sequence = snap->sequence[r];
+        rec->source_time = now - (UA_DateTime) ((now_ns - snap->timestamp_ns[r]) / 100);
+        atomic_store_explicit(&rec->lock, lock + 1, memory_order_release);
+    }
+}
+
+static void
+on_flush_timer(uv_timer_t* handle) {
+    app_context_t* ctx = handle->data;
+    flush(&ctx->lkv, &ctx->snapshot);
+}
+
+/* Start writing behind values on the async loop every conf.system.lkv_interval_ms. */
+void
+lkv_start(app_context_t* ctx) {
+    if (ctx->lkv.map == NULL) {
+        return;
+    }
+    const unsigned int period = ctx->conf.system.lkv_interval_ms;
+    int err = uv_timer_init(uv_default_loop(), &ctx->lkv.flush_timer);
+    assert(err == 0);
+    ctx->lkv.flush_timer.data = ctx;
+    err = uv_timer_start(&ctx->lkv.flush_timer, on_flush_timer, period, period);
+    assert(err == 0);
+}
+
+/* Write the latest values and unmap the file.  Must be called after the async loop stopped. */
+void
+lkv_close(app_context_t* ctx) {
+    lkv_t* lkv = &ctx->lkv;
+    if (lkv->map == NULL) {
+        return;
+    }
+    flush(lkv, &ctx->snapshot);
+    if (msync(lkv->map, lkv->size, MS_SYNC) != 0) {
+        SYSERR("msync", errno);
+    }
+    munmap(lkv->map, lkv->size);
+    lkv->map = NULL;
+}
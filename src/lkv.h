@@ -0,0 +1,11 @@
+#ifndef LKV_H
+#define LKV_H
+
+#include "context.h"
+
+int lkv_open(app_context_t* ctx);
+void lkv_restore(app_context_t* ctx);
+void lkv_start(app_context_t* ctx);
+void lkv_close(app_context_t* ctx);
+
+#endif
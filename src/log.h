@@ -6,7 +6,7 @@
 #define UVERR(f, e) (UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, \
     __FILE__ ":" TOSTR(__LINE__) ": %s failed with %s: %s", (f), uv_err_name(e), uv_strerror(e)))
 #define SYSERR(f, e) (UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, \
-    __FILE__ ":" TOSTR(__LINE__) ": %s failed with errno %d: %s", (f), (e), uv_strerror(e)))
+    __FILE__ ":" TOSTR(__LINE__) ": %s failed with errno %d: %s", (f), (e), uv_strerror(-(e))))
 #define SVERR(f, e) (UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, \
     __FILE__ ":" TOSTR(__LINE__) ": %s failed with %s", (f), UA_StatusCode_name(e)))
 #define ULERR(...) (UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_USERLAND, __VA_ARGS__))
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "realtime.h"
+
+/* Bytes of stack touched by realtime_prefault_stack(). */
+#define PREFAULT_STACK_BYTES (256 * 1024)
+
+/**
+ * Initialize thread attributes for CPU pinning and real-time scheduling
+ *
+ * @param out_attr  Pointer to pthread_attr_t to be initialized.  Caller must
+ *                  destroy it after pthread_create().
+ * @param cpu       CPU the thread is pinned to.  Negative value for no pinning.
+ * @param priority  SCHED_FIFO priority.  0 for inheriting default scheduling.
+ *
+ * Returns 0 on success or error number of failed pthread_attr_* call.
+ */
+int
+realtime_thread_attr_init(pthread_attr_t* out_attr, int cpu, int priority) {
+    int err = pthread_attr_init(out_attr);
+    if (err != 0) {
+        return err;
+    }
+    if (0 <= cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        err = pthread_attr_setaffinity_np(out_attr, sizeof cpus, &cpus);
+        if (err != 0) {
+            SYSERR("pthread_attr_setaffinity_np", err);
+            return err;
+        }
+    }
+    if (0 < priority) {
+        struct sched_param param = { .sched_priority = priority };
+        if ((err = pthread_attr_setinheritsched(out_attr, PTHREAD_EXPLICIT_SCHED)) != 0
+            || (err = pthread_attr_setschedpolicy(out_attr, SCHED_FIFO)) != 0
+            || (err = pthread_attr_setschedparam(out_attr, &param)) != 0) {
+            SYSERR("pthread_attr_setsched*", err);
+            return err;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Pin calling thread to CPU and set its real-time priority
+ *
+ * Failures are logged and ignored so that the process still runs without
+ * privilege, only with worse latency.
+ */
+void
+realtime_apply_to_self(int cpu, int priority) {
+    if (0 <= cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if (err != 0) {
+            SYSERR("pthread_setaffinity_np", err);
+        }
+    }
+    if (0 < priority) {
+        struct sched_param param = { .sched_priority = priority };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            SYSERR("pthread_setschedparam", err);
+        }
+    }
+}
+
+/**
+ * Lock memory and pre-fault heap
+ *
+ * With conf->lock_memory, all current and future pages are locked so that
+ * stacks of threads created later are locked too.  With
+ * conf->prefault_heap_kb, that much heap is touched and released while malloc
+ * is told never to give memory back to the kernel, so later allocations up to
+ * that size don't fault.
+ */
+void
+realtime_lock_memory(const system_conf_t* conf) {
+    if (conf->lock_memory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            SYSERR("mlockall", errno);
+        }
+    }
+    if (conf->prefault_heap_kb == 0) {
+        return;
+    }
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    size_t size = conf->prefault_heap_kb * 1024;
+    char* heap = malloc(size);
+    if (heap == NULL) {
+        ULERR("Pre-faulting %zu kB heap failed.", conf->prefault_heap_kb);
+        return;
+    }
+    memset(heap, 0, size);
+    free(heap);
+    ULINFO("Pre-faulted %zu kB heap.", conf->prefault_heap_kb);
+}
+
+/* Touch stack of calling thread so that page faults don't happen later. */
+void
+realtime_prefault_stack(void) {
+    volatile char stack[PREFAULT_STACK_BYTES];
+    for (size_t i = 0; i < sizeof stack; i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+void
+jitter_init(jitter_stats_t* stats, uint64_t period_ns) {
+    memset(stats, 0, sizeof *stats);
+    stats->period_ns = period_ns;
+}
+
+/**
+ * Record a cycle of periodic activity
+ *
+ * @param stats     Statistics of the activity.
+ * @param now_ns    Monotonic timestamp of this cycle in nanoseconds.
+ *
+ * Deviation of the interval from previous cycle against the period is
+ * accumulated.
+ */
+void
+jitter_record(jitter_stats_t* stats, uint64_t now_ns) {
+    if (stats->last_ns != 0) {
+        int64_t deviation = (int64_t) (now_ns - stats->last_ns) - (int64_t) stats->period_ns;
+        if (stats->samples == 0 || deviation < stats->min_ns) {
+            stats->min_ns = deviation;
+        }
+        if (stats->samples == 0 || stats->max_ns < deviation) {
+            stats->max_ns = deviation;
+        }
+        stats->sum_abs_ns += deviation < 0 ? -deviation : deviation;
+        stats->samples++;
+    }
+    stats->last_ns = now_ns;
+}
+
+void
+jitter_log_and_reset(jitter_stats_t* stats, const char* const name) {
+    if (stats->samples == 0) {
+        return;
+    }
+    ULINFO("Jitter of %s: %lu cycles of %lu us, deviation min %ld us, max %ld us, mean abs %ld us",
+        name, (unsigned long) stats->samples, (unsigned long) (stats->period_ns / 1000),
+        (long) (stats->min_ns / 1000), (long) (stats->max_ns / 1000),
+        (long) (stats->sum_abs_ns / (int64_t) stats->samples / 1000));
+    stats->samples = 0;
+    stats->sum_abs_ns = 0;
+}
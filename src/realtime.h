@@ -0,0 +1,17 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "context.h"
+
+int realtime_thread_attr_init(pthread_attr_t* out_attr, int cpu, int priority);
+void realtime_apply_to_self(int cpu, int priority);
+void realtime_lock_memory(const system_conf_t* conf);
+void realtime_prefault_stack(void);
+void jitter_init(jitter_stats_t* stats, uint64_t period_ns);
+void jitter_record(jitter_stats_t* stats, uint64_t now_ns);
+void jitter_log_and_reset(jitter_stats_t* stats, const char* name);
+
+#endif
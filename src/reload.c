@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+#include "alarm.h"
+#include "cell.h"
+#include "config.h"
+#include "device.h"
+#include "log.h"
+#include "reload.h"
+
+/*
+ * Configuration reload
+ *
+ * The configuration file is watched on the async loop.  When it changes it is
+ * read again into a fresh config_t and compared with the one in use part by
+ * part.  Only changed parts are applied, each by the thread owning it:
+ *
+ *   - Address or port of a device: the device is reconnected.
+ *   - Alarm rules: rule table is replaced keeping active alarms.
+ *   - Robots of a cell or stale_ms: handed over to server threads of cells,
+ *     which add or remove MotionDevices without restarting the server.
+ *
+ * Other connections and client sessions are kept.  [system], [kinematics],
+ * backpressure of devices, number of cells and their port and cpu are fixed at
+ * startup.  Changing them
+ * is only logged.  A file which fails to be read is ignored as a whole.
+ */
+
+/* Delay from the last change of the file to reading it.  Editors write a file in several steps. */
+#define RELOAD_DEBOUNCE_MS 200
+
+static char watched_name[NAME_MAX + 1];
+
+/* Configuration being read.  Too large for the stack of the async loop. */
+static config_t next_conf;
+
+static bool
+address_changed(const device_conf_t* current, const device_conf_t* next) {
+    return current->s_addr != next->s_addr || current->port != next->port;
+}
+
+static bool
+backpressure_changed(const device_conf_t* current, const device_conf_t* next) {
+    return current->backpressure != next->backpressure || current->queue_depth != next->queue_depth;
+}
+
+static bool
+robots_changed(const cell_conf_t* current, const cell_conf_t* next) {
+    return current->robots_size != next->robots_size
+        || memcmp(current->robots, next->robots, current->robots_size * sizeof current->robots[0]) != 0;
+}
+
+/* Log changes which take effect only after restart.  Returns number of them. */
+static int
+log_fixed_changes(const config_t* current, const config_t* next) {
+    int changes = 0;
+    if (memcmp(&current->system, &next->system, sizeof current->system) != 0) {
+        ULINFO("Reload: [system] changed.  Restart to apply it.");
+        changes++;
+    }
+    if (memcmp(&current->kinematics, &next->kinematics, sizeof current->kinematics) != 0) {
+        ULINFO("Reload: [kinematics] changed.  Restart to apply it.");
+        changes++;
+    }
+    if (backpressure_changed(&current->robot, &next->robot) || backpressure_changed(&current->plc, &next->plc)) {
+        ULINFO("Reload: backpressure or queue_depth of a device changed.  Restart to apply it.");
+        changes++;
+    }
+    if (current->cells_size != next->cells_size) {
+        ULINFO("Reload: number of cells changed from %zu to %zu.  Restart to apply it.",
+               current->cells_size, next->cells_size);
+        return changes + 1;
+    }
+    for (size_t i = 0; i < current->cells_size; i++) {
+        if (current->cells[i].port != next->cells[i].port || current->cells[i].cpu != next->cells[i].cpu) {
+            ULINFO("Reload: port or cpu of [cell%zu] changed.  Restart to apply it.", i + 1);
+            changes++;
+        }
+    }
+    return changes;
+}
+
+/*
+ * Apply difference between configuration in use and next one.  ctx->conf is
+ * owned by the async loop after startup except parts fixed at startup, which
+ * other threads read.
+ */
+static void
+apply_config(app_context_t* ctx, const config_t* next) {
+    config_t* const current = &ctx->conf;
+    int applied = 0;
+    int fixed = log_fixed_changes(current, next);
+
+    if (address_changed(&current->robot, &next->robot)) {
+        current->robot.s_addr = next->robot.s_addr;
+        current->robot.port = next->robot.port;
+        device_link_restart(&ctx->robot_link);
+        applied++;
+    }
+    if (address_changed(&current->plc, &next->plc)) {
+        /* PLC has no link yet.  Keep configuration up to date for it. */
+        current->plc.s_addr = next->plc.s_addr;
+        current->plc.port = next->plc.port;
+        applied++;
+    }
+    current->plc.stale_ms = next->plc.stale_ms;
+
+    if (memcmp(&current->alarm, &next->alarm, sizeof current->alarm) != 0) {
+        current->alarm = next->alarm;
+        alarm_update_rules(&ctx->alarms, &current->alarm);
+        ULINFO("Reload: alarm rules updated.");
+        applied++;
+    }
+
+    const bool stale_changed = current->robot.stale_ms != next->robot.stale_ms;
+    current->robot.stale_ms = next->robot.stale_ms;
+    const bool same_cells = current->cells_size == next->cells_size;
+    for (size_t i = 0; i < current->cells_size; i++) {
+        cell_conf_t* const cell_conf = &current->cells[i];
+        const bool changed = same_cells && robots_changed(cell_conf, &next->cells[i]);
+        if (!changed && !stale_changed) {
+            continue;
+        }
+        if (changed) {
+            cell_conf->robots_size = next->cells[i].robots_size;
+            memcpy(cell_conf->robots, next->cells[i].robots, sizeof cell_conf->robots);
+            ULINFO("Reload: robots of [cell%zu] changed.", i + 1);
+        }
+        cell_request_reload(&ctx->cells[i], cell_conf, current->robot.stale_ms);
+        applied++;
+    }
+    if (applied == 0 && fixed == 0) {
+        ULINFO("Reload: configuration unchanged.");
+    } else {
+        ULINFO("Reload: %d changes applied, %d need restart.", applied, fixed);
+    }
+}
+
+static void
+reload_config(uv_timer_t* handle) {
+    app_context_t* ctx = handle->data;
+    ULINFO("Reloading %s.", ctx->config_path);
+    config_init(&next_conf);
+    if (config_read(&next_conf, ctx->config_path) != 0) {
+        ULERR("Reload: %s is invalid.  Keeping current configuration.", ctx->config_path);
+        return;
+    }
+    apply_config(ctx, &next_conf);
+}
+
+/*
+ * Directory of the file is watched rather than the file itself because
+ * editors often replace the file by renaming a new one over it.
+ */
+static void
+on_config_changed(uv_fs_event_t* handle, const char* filename, int events, int status) {
+    app_context_t* ctx = handle->data;
+    if (status < 0) {
+        UVERR("uv_fs_event", status);
+        return;
+    }
+    if (filename != NULL && strcmp(filename, watched_name) != 0) {
+        return;
+    }
+    int err = uv_timer_start(&ctx->config_reload, reload_config, RELOAD_DEBOUNCE_MS, 0);
+    assert(err == 0);
+}
+
+/**
+ * Start watching configuration file
+ *
+ * Must be called on the async loop, or before it runs, after every cell is
+ * initialized by cell_init().  Failure to watch is logged and the process keeps
+ * running with configuration read at startup.
+ */
+void
+reload_start(app_context_t* ctx) {
+    if (ctx->config_path == NULL) {
+        return;
+    }
+    char dir_buf[PATH_MAX];
+    char name_buf[PATH_MAX];
+    snprintf(dir_buf, sizeof dir_buf, "%s", ctx->config_path);
+    snprintf(name_buf, sizeof name_buf, "%s", ctx->config_path);
+    snprintf(watched_name, sizeof watched_name, "%s", basename(name_buf));
+    int err = uv_timer_init(uv_default_loop(), &ctx->config_reload);
+    assert(err == 0);
+    ctx->config_reload.data = ctx;
+    err = uv_fs_event_init(uv_default_loop(), &ctx->config_watch);
+    assert(err == 0);
+    ctx->config_watch.data = ctx;
+    err = uv_fs_event_start(&ctx->config_watch, on_config_changed, dirname(dir_buf), 0);
+    if (err != 0) {
+        UVERR("uv_fs_event_start", err);
+        return;
+    }
+    ULINFO("Watching %s for changes.", ctx->config_path);
+}
@@ -0,0 +1,8 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "context.h"
+
+void reload_start(app_context_t* ctx);
+
+#endif
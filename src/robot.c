@@ -1,137 +1,634 @@
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
 #include <open62541/server.h>
 
+#include "aggregate.h"
 #include "context.h"
+#include "device.h"
+#include "footprint.h"
+#include "frame_schema_generated.h"
+#include "kinematics.h"
+#include "log.h"
 #include "robot.h"
+#include "sample_queue.h"
+#include "snapshot.h"
 #include "util.h"
 
+/*
+ * Instance nodes created here get string NodeIds in namespace 1 built from
+ * their path, e.g. "Robot1/Axis2/ParameterSet/ActualPosition".  Because NodeIds
+ * of children are decided before they are created, an instance never needs to
+ * be browsed after instantiation in order to find its children.
+ */
+#define INSTANCE_NS 1
+#define NODE_PATH_MAX 64
+
+/* Interval of copying values received from devices to variables. */
+#define ROBOT_PUBLISH_INTERVAL_MS 10
+
+/* Property of an object prototype.  Value is the default for every instance. */
+typedef struct {
+    char* name;
+    const UA_DataType* type;
+    const void* value;
+} prototype_property_t;
+
+/* Child object of an object prototype such as FolderType object 'Axes'. */
+typedef struct {
+    UA_UInt16 ns;
+    char* name;
+    UA_UInt32 type_id;     /* Type definition in namespace 0 */
+} prototype_child_t;
+
+/*
+ * Prototype of object instance
+ *
+ * Everything common to instances of one type.  An instance is cloned from its
+ * prototype patching only BrowseName, DisplayName and property values which
+ * differ from the prototype.
+ *
+ * Properties and children listed here are created together with the object
+ * itself between UA_Server_addNode_begin() and UA_Server_addNode_finish().  The
+ * framework finds them already existing when it instantiates the mandatory
+ * children of the type definition so it doesn't create them again.
+ */
+typedef struct {
+    UA_NodeId type_id;
+    UA_UInt16 property_ns;  /* Namespace of property browse names */
+    size_t properties_size;
+    prototype_property_t properties[3];
+    size_t children_size;
+    prototype_child_t children[1];
+} object_prototype_t;
+
+static void
+add_property(UA_Server* server, const char* const path, const UA_NodeId parent,
+             const UA_QualifiedName name, const void* const value, const UA_DataType* const type) {
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    attr.displayName.text = name.name;
+    attr.dataType = type->typeId;
+    attr.valueRank = UA_VALUERANK_SCALAR;
+    UA_Variant_setScalar(&attr.value, (void*) value, type);
+    UA_StatusCode err = UA_Server_addVariableNode(server, UA_NODEID_STRING(INSTANCE_NS, (char*) path), parent,
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY), name,
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_PROPERTYTYPE),
+                                                  attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/**
+ * Begin instantiation of object from prototype
+ *
+ * @param server    Pointer to UA_Server instance.
+ * @param proto     Prototype of the object.
+ * @param parent    NodeId of parent node.  Object is added as HasComponent.
+ * @param path      Path of the object.  Used as string NodeId of the object and
+ *                  prefix of NodeIds of its properties and children.
+ * @param name      BrowseName and DisplayName of the object.
+ * @param values    Property values parallel to proto->properties.  NULL entry
+ *                  or NULL array takes the value in prototype.
+ *
+ * Caller can add more children to the object then must call finish_instance().
+ */
+static void
+begin_instance(UA_Server* server, const object_prototype_t* const proto, const UA_NodeId parent,
+               const char* const path, char* const name, const void* const values[]) {
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", name);
+    const UA_NodeId node_id = UA_NODEID_STRING(INSTANCE_NS, (char*) path);
+    UA_StatusCode err = UA_Server_addNode_begin(server, UA_NODECLASS_OBJECT, node_id, parent,
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                UA_QUALIFIEDNAME(INSTANCE_NS, name), proto->type_id,
+                                                &attr, &UA_TYPES[UA_TYPES_OBJECTATTRIBUTES], NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+    char child_path[NODE_PATH_MAX];
+    for (size_t i = 0; i < proto->properties_size; i++) {
+        const prototype_property_t* const prop = &proto->properties[i];
+        snprintf(child_path, sizeof child_path, "%s/%s", path, prop->name);
+        const void* value = (values != NULL && values[i] != NULL) ? values[i] : prop->value;
+        add_property(server, child_path, node_id, UA_QUALIFIEDNAME(proto->property_ns, prop->name),
+                     value, prop->type);
+    }
+    for (size_t i = 0; i < proto->children_size; i++) {
+        const prototype_child_t* const child = &proto->children[i];
+        snprintf(child_path, sizeof child_path, "%s/%s", path, child->name);
+        attr = UA_ObjectAttributes_default;
+        attr.displayName = UA_LOCALIZEDTEXT("", child->name);
+        err = UA_Server_addObjectNode(server, UA_NODEID_STRING(INSTANCE_NS, child_path), node_id,
+                                      UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                      UA_QUALIFIEDNAME(child->ns, child->name),
+                                      UA_NODEID_NUMERIC(0, child->type_id), attr, NULL, NULL);
+        assert(err == UA_STATUSCODE_GOOD);
+    }
+}
+
+/* Let framework instantiate rest of mandatory children of the object. */
+static void
+finish_instance(UA_Server* server, const char* const path) {
+    UA_StatusCode err = UA_Server_addNode_finish(server, UA_NODEID_STRING(INSTANCE_NS, (char*) path));
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+/*
+ * Prototype of variable 'ActualPosition' of Axis.  Type definition and data
+ * type are taken from the instance declaration in AxisType once.
+ */
+typedef struct {
+    UA_NodeId type_id;
+    UA_NodeId data_type;
+} variable_prototype_t;
+
+static void
+init_actual_position_prototype(UA_Server* server, const namespace_index_t* ns, variable_prototype_t* out_proto) {
+    UA_NodeId param_set;
+    find_node_id(server, &param_set, UA_NODEID_NUMERIC(ns->ns_robot, 16601), /* AxisType */
+                 UA_QUALIFIEDNAME(ns->ns_di, "ParameterSet"));
+    UA_NodeId decl;
+    find_node_id(server, &decl, param_set, UA_QUALIFIEDNAME(ns->ns_robot, "ActualPosition"));
+    find_type_definition(server, &out_proto->type_id, decl);
+    UA_StatusCode err = UA_Server_readDataType(server, decl, &out_proto->data_type);
+    assert(err == UA_STATUSCODE_GOOD);
+}
+
+static void
+add_actual_position(UA_Server* server, const variable_prototype_t* const proto, const char* const axis_path,
+                    const namespace_index_t* ns, UA_NodeId* out_node_id) {
+    char path[NODE_PATH_MAX];
+    snprintf(path, sizeof path, "%s/ParameterSet/ActualPosition", axis_path);
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", "ActualPosition");
+    attr.dataType = proto->data_type;
+    attr.valueRank = UA_VALUERANK_SCALAR;
+    UA_Double zero = 0.0;
+    UA_Variant_setScalar(&attr.value, &zero, &UA_TYPES[UA_TYPES_DOUBLE]);
+    char param_set_path[NODE_PATH_MAX];
+    snprintf(param_set_path, sizeof param_set_path, "%s/ParameterSet", axis_path);
+    UA_StatusCode err = UA_Server_addVariableNode(server, UA_NODEID_STRING(INSTANCE_NS, path),
+                                                  UA_NODEID_STRING(INSTANCE_NS, param_set_path),
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                  UA_QUALIFIEDNAME(ns->ns_robot, "ActualPosition"),
+                                                  proto->type_id, attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+    *out_node_id = UA_NODEID_STRING_ALLOC(INSTANCE_NS, path);
+}
+
+/*
+ * Add TCP pose computed by forward kinematics as Double array variable
+ * 'TcpPose' of MotionDevice.
+ */
+static void
+add_tcp_pose(UA_Server* server, const char* const robot_path, UA_NodeId* out_node_id) {
+    char path[NODE_PATH_MAX];
+    snprintf(path, sizeof path, "%s/TcpPose", robot_path);
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", "TcpPose");
+    attr.description = UA_LOCALIZEDTEXT("en-US", "X, Y, Z [m], roll, pitch, yaw (ZYX Euler) [deg] of tool center point");
+    attr.dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+    attr.valueRank = UA_VALUERANK_ONE_DIMENSION;
+    UA_UInt32 dimensions[1] = { POSE_SIZE };
+    attr.arrayDimensionsSize = 1;
+    attr.arrayDimensions = dimensions;
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_Double zero[POSE_SIZE] = { 0 };
+    UA_Variant_setArray(&attr.value, zero, POSE_SIZE, &UA_TYPES[UA_TYPES_DOUBLE]);
+    attr.value.arrayDimensionsSize = 1;
+    attr.value.arrayDimensions = dimensions;
+    UA_StatusCode err = UA_Server_addVariableNode(server, UA_NODEID_STRING(INSTANCE_NS, path),
+                                                  UA_NODEID_STRING(INSTANCE_NS, (char*) robot_path),
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                  UA_QUALIFIEDNAME(INSTANCE_NS, "TcpPose"),
+                                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                  attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+    *out_node_id = UA_NODEID_STRING_ALLOC(INSTANCE_NS, path);
+}
+
+/*
+ * Add rolling aggregates of an axis as Double variables such as
+ * 'Aggregates/1s/PositionMax' of the Axis.
+ */
+static void
+add_aggregates(UA_Server* server, const char* const axis_path,
+               UA_NodeId out_node_ids[AGGREGATE_WINDOWS][AGGREGATE_STATS][AXIS_FIELDS]) {
+    char path[NODE_PATH_MAX];
+    snprintf(path, sizeof path, "%s/Aggregates", axis_path);
+    UA_ObjectAttributes obj_attr = UA_ObjectAttributes_default;
+    obj_attr.displayName = UA_LOCALIZEDTEXT("en-US", "Aggregates");
+    UA_StatusCode err = UA_Server_addObjectNode(server, UA_NODEID_STRING(INSTANCE_NS, path),
+                                                UA_NODEID_STRING(INSTANCE_NS, (char*) axis_path),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                UA_QUALIFIEDNAME(INSTANCE_NS, "Aggregates"),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+                                                obj_attr, NULL, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+    for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+        char* const window = (char*) aggregate_window_names[w];
+        char window_path[NODE_PATH_MAX];
+        snprintf(window_path, sizeof window_path, "%s/%s", path, window);
+        obj_attr.displayName = UA_LOCALIZEDTEXT("en-US", window);
+        err = UA_Server_addObjectNode(server, UA_NODEID_STRING(INSTANCE_NS, window_path),
+                                      UA_NODEID_STRING(INSTANCE_NS, path),
+                                      UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                      UA_QUALIFIEDNAME(INSTANCE_NS, window),
+                                      UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+                                      obj_attr, NULL, NULL);
+        assert(err == UA_STATUSCODE_GOOD);
+        for (int s = 0; s < AGGREGATE_STATS; s++) {
+            for (int f = 0; f < AXIS_FIELDS; f++) {
+                char name[24];
+                snprintf(name, sizeof name, "%s%s", aggregate_field_names[f], aggregate_stat_names[s]);
+                char var_path[NODE_PATH_MAX];
+                snprintf(var_path, sizeof var_path, "%s/%s", window_path, name);
+                UA_VariableAttributes attr = UA_VariableAttributes_default;
+                attr.displayName = UA_LOCALIZEDTEXT("en-US", name);
+                attr.dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+                attr.valueRank = UA_VALUERANK_SCALAR;
+                attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+                UA_Double nan = NAN;
+                UA_Variant_setScalar(&attr.value, &nan, &UA_TYPES[UA_TYPES_DOUBLE]);
+                err = UA_Server_addVariableNode(server, UA_NODEID_STRING(INSTANCE_NS, var_path),
+                                                UA_NODEID_STRING(INSTANCE_NS, window_path),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                UA_QUALIFIEDNAME(INSTANCE_NS, name),
+                                                UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                attr, NULL, NULL);
+                assert(err == UA_STATUSCODE_GOOD);
+                out_node_ids[w][s][f] = UA_NODEID_STRING_ALLOC(INSTANCE_NS, var_path);
+            }
+        }
+    }
+}
+
+/* Identification of the controller and robots.  Same for every instance. */
+static const UA_LocalizedText manufacturer = { UA_STRING_STATIC("en-US"), UA_STRING_STATIC("EXAMPLE Robotics Corp.") };
+static const UA_LocalizedText controller_model = { UA_STRING_STATIC("en-US"), UA_STRING_STATIC("ROBOT MASTER II") };
+static const UA_LocalizedText robot_model = { UA_STRING_STATIC("en-US"), UA_STRING_STATIC("Robot TYPE III") };
+static const UA_String controller_serial = UA_STRING_STATIC("ABC12345");
+static const UA_String rev = UA_STRING_STATIC("Revision 1.0.0");
+
+#define SOFTWARE_PATH "Controller/Software"
+
+/* SoftwareIdentifier object of a robot under Software folder of Controller. */
+static void
+add_software_entry(UA_Server* server, const namespace_index_t* ns, int robot) {
+    const object_prototype_t software_proto = {
+        .type_id = UA_NODEID_NUMERIC(ns->ns_di, 15106),     /* Type is SoftwareType */
+        .property_ns = ns->ns_di,
+        .properties_size = 3,
+        .properties = {
+            { "Manufacturer", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &manufacturer },
+            { "Model", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &robot_model },
+            { "SoftwareRevision", &UA_TYPES[UA_TYPES_STRING], &rev },
+        },
+    };
+    char robot_name[20];
+    snprintf(robot_name, sizeof robot_name, "Robot%d", robot + 1);
+    char path[NODE_PATH_MAX];
+    snprintf(path, sizeof path, SOFTWARE_PATH "/%s", robot_name);
+    begin_instance(server, &software_proto, UA_NODEID_STRING(INSTANCE_NS, SOFTWARE_PATH), path, robot_name, NULL);
+    finish_instance(server, path);
+}
+
+/*
+ * MotionDevice object of a robot and its Axis objects under MotionDevices
+ * folder.  NodeIds are kept in robot_nodes of the context.
+ */
+static void
+add_motion_device(UA_Server* server, cell_t* cell, const variable_prototype_t* actual_position_proto, int robot) {
+    app_context_t* ctx = cell->ctx;
+    const namespace_index_t* ns = &cell->ns;
+    const object_prototype_t motion_device_proto = {
+        .type_id = UA_NODEID_NUMERIC(ns->ns_robot, 1004),   /* Type is MotionDeviceType */
+        .property_ns = ns->ns_di,
+        .properties_size = 3,
+        .properties = {
+            { "Manufacturer", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &manufacturer },
+            { "Model", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &robot_model },
+            { "SerialNumber", &UA_TYPES[UA_TYPES_STRING], NULL },  /* Unique to each instance */
+        },
+        .children_size = 1,
+        .children = {
+            { ns->ns_robot, "Axes", UA_NS0ID_FOLDERTYPE },
+        },
+    };
+    const object_prototype_t axis_proto = {
+        .type_id = UA_NODEID_NUMERIC(ns->ns_robot, 16601),  /* Type is AxisType */
+        .children_size = 1,
+        .children = {
+            { ns->ns_di, "ParameterSet", UA_NS0ID_BASEOBJECTTYPE },
+        },
+    };
+    robot_nodes_t* const nodes = &ctx->robot_nodes[robot];
+    char robot_name[20];
+    snprintf(robot_name, sizeof robot_name, "Robot%d", robot + 1);
+    char sn_str[20];
+    snprintf(sn_str, sizeof sn_str, "XYZ987%d", robot);
+    UA_String serial = UA_STRING(sn_str);
+    const void* const values[] = { NULL, NULL, &serial };
+    begin_instance(server, &motion_device_proto, cell->motion_devices, robot_name, robot_name, values);
+    nodes->motion_device = UA_NODEID_STRING_ALLOC(INSTANCE_NS, robot_name);
+    add_tcp_pose(server, robot_name, &nodes->tcp_pose);
+    char axes_path[NODE_PATH_MAX];
+    snprintf(axes_path, sizeof axes_path, "%s/Axes", robot_name);
+    const UA_NodeId axesNodeId = UA_NODEID_STRING(INSTANCE_NS, axes_path);
+    for (int j = 0; j < MAX_AXES; j++) {
+        char axis_name[20];
+        snprintf(axis_name, sizeof axis_name, "Axis%d", j + 1);
+        char axis_path[NODE_PATH_MAX];
+        snprintf(axis_path, sizeof axis_path, "%s/%s", robot_name, axis_name);
+        begin_instance(server, &axis_proto, axesNodeId, axis_path, axis_name, NULL);
+        add_actual_position(server, actual_position_proto, axis_path, ns, &nodes->actual_position[j]);
+        add_aggregates(server, axis_path, nodes->aggregate[j]);
+        finish_instance(server, axis_path);
+        nodes->axis[j] = UA_NODEID_STRING_ALLOC(INSTANCE_NS, axis_path);
+    }
+    finish_instance(server, robot_name);
+    /* Let the cell publish every value of the robot once. */
+    nodes->published_version = 0;
+    nodes->pose_published_version = 0;
+    nodes->aggregate_published_version = 0;
+}
+
+/**
+ * Instantiate MotionDeviceSystem of a cell
+ *
+ * @param server    Pointer to UA_Server instance of the cell.
+ * @param cell      Cell whose robots are instantiated.  Their NodeIds are kept
+ *                  in robot_nodes of the context.
+ */
 void
-instantiate_robot_rest_nodes(UA_Server *server, app_context_t* ctx) {
+instantiate_robot_rest_nodes(UA_Server *server, cell_t* cell) {
+    const namespace_index_t* ns = &cell->ns;
     /* Add MotionDeviceSystem object under DeviceSet */
     UA_ObjectAttributes attr = UA_ObjectAttributes_default;
     attr.displayName = UA_LOCALIZEDTEXT("en-US", "MotionDeviceSystem");
     UA_NodeId motionDeviceSystemNodeId;
     UA_StatusCode err = UA_Server_addObjectNode(server, UA_NODEID_NULL,
-                                                UA_NODEID_NUMERIC(ctx->ns.ns_di, 5001),    /* Parent is DeviceSet */
+                                                UA_NODEID_NUMERIC(ns->ns_di, 5001),    /* Parent is DeviceSet */
                                                 UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
                                                 UA_QUALIFIEDNAME(1, "MotionDeviceSystem"),
-                                                UA_NODEID_NUMERIC(ctx->ns.ns_robot, 1002), /* Type is MotionDeviceSystemType */
+                                                UA_NODEID_NUMERIC(ns->ns_robot, 1002), /* Type is MotionDeviceSystemType */
                                                 attr, NULL, &motionDeviceSystemNodeId);
     assert(err == UA_STATUSCODE_GOOD);
     /*
-     * Lookup child FolderType object 'Controllers'.  Controllers is
-     * automatically instantiated via data type definition of MotionDeviceSystem
-     * node.
+     * Lookup child FolderType object 'Controllers' and 'MotionDevices'.  They
+     * are automatically instantiated via data type definition of
+     * MotionDeviceSystem node.  MotionDevices is kept so that robots can be
+     * added after startup.
      */
     UA_NodeId collectorsNodeId;
     find_node_id(server, &collectorsNodeId, motionDeviceSystemNodeId,
-        UA_QUALIFIEDNAME(ctx->ns.ns_robot, "Controllers"));
+        UA_QUALIFIEDNAME(ns->ns_robot, "Controllers"));
+    find_node_id(server, &cell->motion_devices, motionDeviceSystemNodeId,
+        UA_QUALIFIEDNAME(ns->ns_robot, "MotionDevices"));
+
     /* Add a ControllerIdentifier object under Controllers folder. */
-    attr = UA_ObjectAttributes_default;
-    char controller_name[20];
-    snprintf(controller_name, sizeof controller_name, "Controller");
-    attr.displayName = UA_LOCALIZEDTEXT("en-US", controller_name);
-    UA_NodeId ControllerIdNodeId;
-    err = UA_Server_addObjectNode(server, UA_NODEID_NULL,
-                                    collectorsNodeId,                           /* Parent is Controllers */
-                                    UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                                    UA_QUALIFIEDNAME(1, controller_name),
-                                    UA_NODEID_NUMERIC(ctx->ns.ns_robot, 1003),  /* Type is ControllerType */
-                                    attr, NULL, &ControllerIdNodeId);
-    assert(err == UA_STATUSCODE_GOOD);
-    UA_LocalizedText manufacturer = UA_LOCALIZEDTEXT("en-US", "EXAMPLE Robotics Corp.");
-    err = UA_Server_writeObjectProperty_scalar(server, ControllerIdNodeId,
-        UA_QUALIFIEDNAME(ctx->ns.ns_di, "Manufacturer"), &manufacturer, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-    assert(err == UA_STATUSCODE_GOOD);
-    UA_LocalizedText model = UA_LOCALIZEDTEXT("en-US", "ROBOT MASTER II");
-    err = UA_Server_writeObjectProperty_scalar(server, ControllerIdNodeId,
-        UA_QUALIFIEDNAME(ctx->ns.ns_di, "Model"), &model, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-    assert(err == UA_STATUSCODE_GOOD);
-    UA_String serial = UA_STRING("ABC12345");
-    err = UA_Server_writeObjectProperty_scalar(server, ControllerIdNodeId,
-        UA_QUALIFIEDNAME(ctx->ns.ns_di, "SerialNumber"), &serial, &UA_TYPES[UA_TYPES_STRING]);
-    assert(err == UA_STATUSCODE_GOOD);
-    /*
-        * Lookup child FolderType object 'Software' and 'MotionDevices'.  Software is automatically
-        * instantiated via data type definition of ControllerIdentifier node.
-        */
-    UA_NodeId softwareNodeId;
-    find_node_id(server, &softwareNodeId, ControllerIdNodeId, UA_QUALIFIEDNAME(ctx->ns.ns_robot, "Software"));
-    /* Add SoftwareIdentifier objects under Software folder. */
-    for (int i = 0; i < MAX_ROBOTS; i++) {
-        char robot_name[20];
-        snprintf(robot_name, sizeof robot_name, "Robot%d", i + 1);
-        attr = UA_ObjectAttributes_default;
-        attr.displayName = UA_LOCALIZEDTEXT("en-US", robot_name);
-        UA_NodeId softwareIdNodeId;
-        err = UA_Server_addObjectNode(server, UA_NODEID_NULL, softwareNodeId,
-                                        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                                        UA_QUALIFIEDNAME(1, robot_name),
-                                        UA_NODEID_NUMERIC(ctx->ns.ns_di, 15106),    // Type is SoftwareType
-                                        attr, NULL, &softwareIdNodeId);
-        assert(err == UA_STATUSCODE_GOOD);
-        err = UA_Server_writeObjectProperty_scalar(server, softwareIdNodeId,
-                UA_QUALIFIEDNAME(ctx->ns.ns_di, "Manufacturer"), &manufacturer, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-        assert(err == UA_STATUSCODE_GOOD);
-        UA_LocalizedText model = UA_LOCALIZEDTEXT("en-US", "Robot TYPE III");
-        err = UA_Server_writeObjectProperty_scalar(server, softwareIdNodeId,
-                UA_QUALIFIEDNAME(ctx->ns.ns_di, "Model"), &model, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-        assert(err == UA_STATUSCODE_GOOD);
-        UA_String rev = UA_STRING("Revision 1.0.0");
-        err = UA_Server_writeObjectProperty_scalar(server, softwareIdNodeId,
-                UA_QUALIFIEDNAME(ctx->ns.ns_di, "SoftwareRevision"), &rev, &UA_TYPES[UA_TYPES_STRING]);
-        assert(err == UA_STATUSCODE_GOOD);
+    const object_prototype_t controller_proto = {
+        .type_id = UA_NODEID_NUMERIC(ns->ns_robot, 1003),   /* Type is ControllerType */
+        .property_ns = ns->ns_di,
+        .properties_size = 3,
+        .properties = {
+            { "Manufacturer", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &manufacturer },
+            { "Model", &UA_TYPES[UA_TYPES_LOCALIZEDTEXT], &controller_model },
+            { "SerialNumber", &UA_TYPES[UA_TYPES_STRING], &controller_serial },
+        },
+        .children_size = 1,
+        .children = {
+            { ns->ns_robot, "Software", UA_NS0ID_FOLDERTYPE },
+        },
+    };
+    begin_instance(server, &controller_proto, collectorsNodeId, "Controller", "Controller", NULL);
+    for (size_t k = 0; k < cell->conf.robots_size; k++) {
+        add_software_entry(server, ns, cell->conf.robots[k]);
     }
-    /*
-     * Lookup child FolderType object 'MotionDevices'.  MotionDevices is
-     * automatically instantiated via data type definition of MotionDeviceSystem
-     * node.
-     */
-    UA_NodeId motionDevicesNodeId;
-    find_node_id(server, &motionDevicesNodeId, motionDeviceSystemNodeId,
-        UA_QUALIFIEDNAME(ctx->ns.ns_robot, "MotionDevices"));
+    finish_instance(server, "Controller");
+
+    variable_prototype_t actual_position_proto;
+    init_actual_position_prototype(server, ns, &actual_position_proto);
+    for (size_t k = 0; k < cell->conf.robots_size; k++) {
+        const int i = cell->conf.robots[k];
+        size_t heap_before = footprint_heap_bytes();
+        add_motion_device(server, cell, &actual_position_proto, i);
+        cell->footprint.motion_device_heap_bytes[i] = footprint_heap_bytes() - heap_before;
+    }
+    UA_NodeId_deleteMembers(&actual_position_proto.type_id);
+    UA_NodeId_deleteMembers(&actual_position_proto.data_type);
+}
+
+/**
+ * Add a robot to address space of a running cell
+ *
+ * Creates its SoftwareIdentifier and MotionDevice the same way as
+ * instantiate_robot_rest_nodes().  Caller must own the robot, i.e.
+ * ctx->robot_owner of the robot is the index of the cell.
+ */
+void
+robot_add(UA_Server* server, cell_t* cell, int robot) {
+    add_software_entry(server, &cell->ns, robot);
+    variable_prototype_t actual_position_proto;
+    init_actual_position_prototype(server, &cell->ns, &actual_position_proto);
+    add_motion_device(server, cell, &actual_position_proto, robot);
+    UA_NodeId_deleteMembers(&actual_position_proto.type_id);
+    UA_NodeId_deleteMembers(&actual_position_proto.data_type);
+}
+
+static void
+release_nodes(robot_nodes_t* nodes) {
+    UA_NodeId_deleteMembers(&nodes->motion_device);
+    UA_NodeId_deleteMembers(&nodes->tcp_pose);
+    for (int j = 0; j < MAX_AXES; j++) {
+        UA_NodeId_deleteMembers(&nodes->axis[j]);
+        UA_NodeId_deleteMembers(&nodes->actual_position[j]);
+        for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+            for (int s = 0; s < AGGREGATE_STATS; s++) {
+                for (int f = 0; f < AXIS_FIELDS; f++) {
+                    UA_NodeId_deleteMembers(&nodes->aggregate[j][w][s][f]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Remove a robot from address space of a running cell
+ *
+ * Deletes its SoftwareIdentifier and MotionDevice together with their
+ * children and releases NodeIds kept in robot_nodes so that another cell can
+ * take the robot over.
+ */
+void
+robot_remove(UA_Server* server, cell_t* cell, int robot) {
+    app_context_t* ctx = cell->ctx;
+    robot_nodes_t* const nodes = &ctx->robot_nodes[robot];
+    UA_StatusCode err = UA_Server_deleteNode(server, nodes->motion_device, true);
+    if (err != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_deleteNode", err);
+    }
+    char path[NODE_PATH_MAX];
+    snprintf(path, sizeof path, SOFTWARE_PATH "/Robot%d", robot + 1);
+    err = UA_Server_deleteNode(server, UA_NODEID_STRING(INSTANCE_NS, path), true);
+    if (err != UA_STATUSCODE_GOOD) {
+        SVERR("UA_Server_deleteNode", err);
+    }
+    release_nodes(nodes);
+    cell->footprint.motion_device_heap_bytes[robot] = 0;
+}
+
+void
+release_robot_nodes(app_context_t* ctx) {
     for (int i = 0; i < MAX_ROBOTS; i++) {
-        char robot_name[20];
-        snprintf(robot_name, sizeof robot_name, "Robot%d", i + 1);
-        attr = UA_ObjectAttributes_default;
-        attr.displayName = UA_LOCALIZEDTEXT("en-US", robot_name);
-        UA_NodeId motionDeviceNodeId;
-        err = UA_Server_addObjectNode(server, UA_NODEID_NULL,
-                                        motionDevicesNodeId,
-                                        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                                        UA_QUALIFIEDNAME(1, robot_name),
-                                        UA_NODEID_NUMERIC(ctx->ns.ns_robot, 1004),  // Type is MotionDeviceType
-                                        attr, NULL, &motionDeviceNodeId);
-        err = UA_Server_writeObjectProperty_scalar(server, motionDeviceNodeId,
-            UA_QUALIFIEDNAME(ctx->ns.ns_di, "Manufacturer"), &manufacturer, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-        assert(err == UA_STATUSCODE_GOOD);
-        err = UA_Server_writeObjectProperty_scalar(server, motionDeviceNodeId,
-                UA_QUALIFIEDNAME(ctx->ns.ns_di, "Model"), &model, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
-        assert(err == UA_STATUSCODE_GOOD);
-        char sn_str[20];
-        snprintf(sn_str, sizeof sn_str, "XYZ987%d", i);
-        UA_String serial = UA_STRING(sn_str);
-        err = UA_Server_writeObjectProperty_scalar(server, motionDeviceNodeId,
-            UA_QUALIFIEDNAME(ctx->ns.ns_di, "SerialNumber"), &serial, &UA_TYPES[UA_TYPES_STRING]);
-        assert(err == UA_STATUSCODE_GOOD);
-        /*
-         * Lookup child FolderType object 'Axes'.  Axes is automatically
-         * instantiated via data type definition of MotionDevice node.
-         */
-        UA_NodeId axesNodeId;
-        find_node_id(server, &axesNodeId, motionDeviceNodeId, UA_QUALIFIEDNAME(ctx->ns.ns_robot, "Axes"));
-        for (int j = 0; j < MAX_AXES; j++) {
-            char axis_name[20];
-            snprintf(axis_name, sizeof axis_name, "Axis%d", j + 1);
-            attr = UA_ObjectAttributes_default;
-            attr.displayName = UA_LOCALIZEDTEXT("en-US", axis_name);
-            UA_NodeId axisNodeId;
-            err = UA_Server_addObjectNode(server, UA_NODEID_NULL,
-                                            axesNodeId,
-                                            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                                            UA_QUALIFIEDNAME(1, axis_name),
-                                            UA_NODEID_NUMERIC(ctx->ns.ns_robot, 16601),  // Type is AxisType
-                                            attr, NULL, &axisNodeId);
+        release_nodes(&ctx->robot_nodes[i]);
+    }
+}
+
+/* Copy rolling aggregates of a robot to its variables if windows slid. */
+static void
+publish_aggregates(UA_Server* server, app_context_t* ctx, int robot) {
+    robot_nodes_t* const nodes = &ctx->robot_nodes[robot];
+    float result[AGGREGATE_WINDOWS][AGGREGATE_STATS][AGGREGATE_VALUES];
+    unsigned int version = aggregate_read(&ctx->aggregates, robot, result);
+    if (version == nodes->aggregate_published_version) {
+        return;
+    }
+    nodes->aggregate_published_version = version;
+    for (int j = 0; j < MAX_AXES; j++) {
+        for (int w = 0; w < AGGREGATE_WINDOWS; w++) {
+            for (int s = 0; s < AGGREGATE_STATS; s++) {
+                for (int f = 0; f < AXIS_FIELDS; f++) {
+                    UA_Double value = result[w][s][f * MAX_AXES + j];
+                    UA_Variant v;
+                    UA_Variant_setScalar(&v, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+                    UA_Server_writeValue(server, nodes->aggregate[j][w][s][f], v);
+                }
+            }
+        }
+    }
+}
+
+/* Write value with given status and source timestamp. */
+static void
+write_sourced(UA_Server* server, const UA_NodeId node_id, UA_Double value, UA_StatusCode status,
+              UA_DateTime source_time) {
+    UA_DataValue dv;
+    UA_DataValue_init(&dv);
+    UA_Variant_setScalar(&dv.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    dv.hasValue = true;
+    dv.status = status;
+    dv.hasStatus = true;
+    dv.sourceTimestamp = source_time;
+    dv.hasSourceTimestamp = true;
+    UA_Server_writeDataValue(server, node_id, dv);
+}
+
+/*
+ * Write position of every axis.  With source_time of 0 values are written
+ * plainly and get the time of the write as source timestamp.
+ */
+static void
+write_positions(UA_Server* server, const robot_nodes_t* nodes, const float values[AXIS_FIELDS][MAX_AXES],
+                UA_StatusCode status, UA_DateTime source_time) {
+    for (int j = 0; j < MAX_AXES; j++) {
+        UA_Double position = values[FRAME_SCHEMA_ACTUALPOSITION_FIELD][j];
+        if (source_time != 0) {
+            write_sourced(server, nodes->actual_position[j], position, status, source_time);
+            continue;
+        }
+        UA_Variant v;
+        UA_Variant_setScalar(&v, &position, &UA_TYPES[UA_TYPES_DOUBLE]);
+        UA_Server_writeValue(server, nodes->actual_position[j], v);
+    }
+}
+
+/*
+ * Publish values of a robot in snapshot if updated since previous call.
+ * Frames overwritten in the snapshot meanwhile are counted as conflated.
+ * Values restored from last known value file stay uncertain with their
+ * original source timestamp until a frame of the robot arrives.
+ */
+static void
+publish_latest(UA_Server* server, app_context_t* ctx, int robot) {
+    robot_nodes_t* const nodes = &ctx->robot_nodes[robot];
+    float values[AXIS_FIELDS][MAX_AXES];
+    uint32_t sequence;
+    const unsigned int version = snapshot_read(&ctx->snapshot, robot, values, &sequence);
+    if (version == nodes->published_version) {
+        return;
+    }
+    if (nodes->published_version != 0) {
+        /* Lock value advances by 2 per frame. */
+        const unsigned int skipped = (version - nodes->published_version) / 2 - 1;
+        atomic_fetch_add_explicit(&ctx->robot_link.stats[robot].conflated, skipped, memory_order_relaxed);
+    }
+    nodes->published_version = version;
+    if (version == nodes->restored_version) {
+        write_positions(server, nodes, values, UA_STATUSCODE_UNCERTAINLASTUSABLEVALUE, nodes->restored_time);
+    } else {
+        write_positions(server, nodes, values, UA_STATUSCODE_GOOD, 0);
+    }
+}
+
+/*
+ * Publish every frame of a robot queued when the call started, oldest first,
+ * each with the time it arrived as source timestamp.  Frames pushed meanwhile
+ * wait for the next call, so that a fast device can't keep the server thread
+ * here.  The queue thus only fills up, dropping the oldest or pausing reads,
+ * when the server thread stalls for queue_depth frames.  Until the first frame
+ * arrives, values restored from last known value file are published from
+ * snapshot instead.
+ */
+static void
+publish_queued(UA_Server* server, app_context_t* ctx, int robot) {
+    robot_nodes_t* const nodes = &ctx->robot_nodes[robot];
+    device_link_t* const link = &ctx->robot_link;
+    sample_queue_t* const queue = &link->queues[robot];
+    const unsigned int queued = sample_queue_length(queue);
+    sample_t sample;
+    unsigned int n = 0;
+    while (n < queued && sample_queue_pop(queue, &sample)) {
+        write_positions(server, nodes, sample.value, UA_STATUSCODE_GOOD, sample.source_time);
+        n++;
+    }
+    if (n != 0) {
+        nodes->published_version = sample.version;
+        device_link_drained(link);
+    } else if (nodes->published_version == 0 && nodes->restored_version != 0) {
+        publish_latest(server, ctx, robot);
+    }
+}
+
+/*
+ * Copy values of robots of the cell updated since previous call from
+ * snapshot or sample queues depending on backpressure of the device, TCP
+ * poses from forward kinematics and rolling aggregates to their variables.
+ */
+static void
+publish_robot_values(UA_Server* server, void* data) {
+    cell_t* cell = data;
+    app_context_t* ctx = cell->ctx;
+    for (size_t k = 0; k < cell->conf.robots_size; k++) {
+        const int i = cell->conf.robots[k];
+        robot_nodes_t* const nodes = &ctx->robot_nodes[i];
+        double pose[POSE_SIZE];
+        unsigned int version = kinematics_read_pose(i, pose);
+        if (version != nodes->pose_published_version) {
+            nodes->pose_published_version = version;
+            UA_Variant v;
+            UA_Variant_setArray(&v, pose, POSE_SIZE, &UA_TYPES[UA_TYPES_DOUBLE]);
+            UA_Server_writeValue(server, nodes->tcp_pose, v);
+        }
+        publish_aggregates(server, ctx, i);
+        if (ctx->robot_link.conf->backpressure == BACKPRESSURE_CONFLATE) {
+            publish_latest(server, ctx, i);
+        } else {
+            publish_queued(server, ctx, i);
         }
     }
 }
+
+void
+robot_start_publishing(UA_Server* server, cell_t* cell) {
+    UA_StatusCode err = UA_Server_addRepeatedCallback(server, publish_robot_values, cell,
+                                                      ROBOT_PUBLISH_INTERVAL_MS, NULL);
+    assert(err == UA_STATUSCODE_GOOD);
+}
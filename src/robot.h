@@ -3,6 +3,10 @@
 
 #include "context.h"
 
-void instantiate_robot_rest_nodes(UA_Server *server, app_context_t* ctx);
+void instantiate_robot_rest_nodes(UA_Server *server, cell_t* cell);
+void robot_add(UA_Server* server, cell_t* cell, int robot);
+void robot_remove(UA_Server* server, cell_t* cell, int robot);
+void release_robot_nodes(app_context_t* ctx);
+void robot_start_publishing(UA_Server* server, cell_t* cell);
 
 #endif
@@ -0,0 +1,74 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "context.h"
+
+/*
+ * Bounded queue of frames of a robot
+ *
+ * Only the async loop pushes and only the server thread owning the robot
+ * pops.  Queue holds at most depth samples.  Pushing to full queue drops the
+ * oldest one by advancing tail, so the latest sample always gets in.  Since
+ * tail may move under a popping reader, the reader copies the slot first and
+ * keeps the copy only if it advanced tail itself.
+ */
+
+static inline unsigned int
+sample_queue_length(sample_queue_t* queue) {
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    return head - tail;
+}
+
+/**
+ * Push values of a robot in snapshot to queue
+ *
+ * Must be called on the async loop, which is the writer of the snapshot.
+ * Returns true if the oldest sample was dropped to make room.
+ *
+ * @param source_time   When the frame the values came from arrived.
+ */
+static inline bool
+sample_queue_push(sample_queue_t* queue, unsigned int depth, const snapshot_t* snap, int robot,
+                  UA_DateTime source_time) {
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    bool dropped = false;
+    if (depth <= head - tail) {
+        /* Fails only if the reader has just popped it, which makes room as well. */
+        dropped = atomic_compare_exchange_strong_explicit(&queue->tail, &tail, tail + 1,
+                                                          memory_order_acq_rel, memory_order_acquire);
+    }
+    sample_t* s = &queue->samples[head % SAMPLE_QUEUE_SIZE];
+    for (int f = 0; f < AXIS_FIELDS; f++) {
+        memcpy(s->value[f], snap->value[f][robot], sizeof s->value[f]);
+    }
+    s->sequence = snap->sequence[robot];
+    s->version = atomic_load_explicit(&snap->lock[robot], memory_order_relaxed);
+    s->source_time = source_time;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return dropped;
+}
+
+/* Pop the oldest sample.  Returns false if queue is empty. */
+static inline bool
+sample_queue_pop(sample_queue_t* queue, sample_t* out_sample) {
+    for (;;) {
+        unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        memcpy(out_sample, &queue->samples[tail % SAMPLE_QUEUE_SIZE], sizeof *out_sample);
+        if (atomic_compare_exchange_strong_explicit(&queue->tail, &tail, tail + 1,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            return true;
+        }
+    }
+}
+
+#endif
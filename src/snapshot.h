@@ -0,0 +1,61 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "context.h"
+
+/*
+ * Sequence lock of per robot snapshot
+ *
+ * Only the async loop thread writes a robot's snapshot.  Lock value is odd
+ * while it is being written.  Readers copy values out and retry when lock
+ * value was odd or changed during the copy.  Readers never block the writer.
+ */
+
+static inline void
+snapshot_write_begin(snapshot_t* snap, int robot) {
+    unsigned int v = atomic_load_explicit(&snap->lock[robot], memory_order_relaxed);
+    atomic_store_explicit(&snap->lock[robot], v + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+snapshot_write_end(snapshot_t* snap, int robot) {
+    unsigned int v = atomic_load_explicit(&snap->lock[robot], memory_order_relaxed);
+    atomic_store_explicit(&snap->lock[robot], v + 1, memory_order_release);
+}
+
+/**
+ * Copy consistent values of a robot out of snapshot
+ *
+ * @param snap          Snapshot to read.
+ * @param robot         Index of robot.
+ * @param out_values    Values of the robot.
+ * @param out_sequence  Sequence number of frame the values came from.
+ *
+ * Returns lock value the copy was taken at.  It is 0 until the first frame of
+ * the robot arrives and changes every time new frame is written, so callers can
+ * compare it with the previous one to know whether values were updated.
+ */
+static inline unsigned int
+snapshot_read(snapshot_t* snap, int robot, float out_values[AXIS_FIELDS][MAX_AXES], uint32_t* out_sequence) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&snap->lock[robot], memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        for (int f = 0; f < AXIS_FIELDS; f++) {
+            memcpy(out_values[f], snap->value[f][robot], sizeof out_values[f]);
+        }
+        *out_sequence = snap->sequence[robot];
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&snap->lock[robot], memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return before;
+}
+
+#endif
@@ -58,3 +58,18 @@ find_node_id(UA_Server *server, UA_NodeId* out_node_id, const UA_NodeId start_no
     *out_node_id = bpr.targets->targetId.nodeId;
     UA_BrowsePathResult_deleteMembers(&bpr);
 }
+
+void
+find_type_definition(UA_Server *server, UA_NodeId* out_type_id, const UA_NodeId node) {
+    UA_BrowseDescription bd;
+    UA_BrowseDescription_init(&bd);
+    bd.nodeId = node;
+    bd.browseDirection = UA_BROWSEDIRECTION_FORWARD;
+    bd.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HASTYPEDEFINITION);
+    bd.includeSubtypes = false;
+    UA_BrowseResult br = UA_Server_browse(server, 1, &bd);
+    assert(br.statusCode == UA_STATUSCODE_GOOD && br.referencesSize > 0);
+    UA_StatusCode err = UA_NodeId_copy(&br.references->nodeId.nodeId, out_type_id);
+    assert(err == UA_STATUSCODE_GOOD);
+    UA_BrowseResult_deleteMembers(&br);
+}
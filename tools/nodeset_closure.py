@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""
+Prune companion NodeSet2 files down to the type closure actually used.
+
+Given root types by BrowseName, this keeps the roots, their supertypes, their
+mandatory instance declarations (recursively), everything those nodes refer to
+as type definition, data type, encoding or reference type, and every node
+hanging directly under namespace 0 (e.g. DeviceSet, NamespaceMetadata and type
+dictionaries) together with its children.  All data types and reference types
+are kept so that generated data type code stays consistent with the nodeset.
+Everything else is dropped along with references pointing to dropped nodes.
+
+Closure is computed across all given nodesets at once so that nodes of DI
+needed by Robotics or PLCopen are kept.  Namespace 0 is never pruned.
+
+Usage:
+    nodeset_closure.py --nodeset LABEL=IN.xml=OUT.xml [--nodeset ...]
+                       --root LABEL:BrowseName [--root ...]
+                       [--report REPORT.txt]
+"""
+
+import argparse
+import sys
+import xml.etree.ElementTree as ET
+
+UA_NS = "http://opcfoundation.org/UA/2011/03/UANodeSet.xsd"
+NS0_URI = "http://opcfoundation.org/UA/"
+
+# Well known NodeIds in namespace 0
+MANDATORY = (NS0_URI, "i=78")
+HIERARCHICAL_CHILD = {
+    (NS0_URI, "i=35"),      # Organizes
+    (NS0_URI, "i=46"),      # HasProperty
+    (NS0_URI, "i=47"),      # HasComponent
+    (NS0_URI, "i=49"),      # HasOrderedComponent
+}
+HAS_SUBTYPE = (NS0_URI, "i=45")
+HAS_MODELLING_RULE = (NS0_URI, "i=37")
+# Forward references whose targets are needed by the source node itself
+DEPENDENCY = {
+    (NS0_URI, "i=40"),      # HasTypeDefinition
+    (NS0_URI, "i=38"),      # HasEncoding
+    (NS0_URI, "i=39"),      # HasDescription
+    HAS_MODELLING_RULE,
+}
+TYPE_TAGS = {"UAObjectType", "UAVariableType"}
+ALWAYS_KEEP_TAGS = {"UADataType", "UAReferenceType"}
+
+
+def tag_of(elem):
+    return elem.tag.split("}", 1)[-1]
+
+
+def split_node_id(text):
+    """Split NodeId string into (namespace index, identifier part)."""
+    text = text.strip()
+    if text.startswith("ns="):
+        ns, ident = text.split(";", 1)
+        return int(ns[3:]), ident
+    return 0, text
+
+
+class NodeSet:
+    def __init__(self, label, in_path, out_path):
+        self.label = label
+        self.in_path = in_path
+        self.out_path = out_path
+        ET.register_namespace("", UA_NS)
+        self.tree = ET.parse(in_path)
+        root = self.tree.getroot()
+        uris = root.find("{%s}NamespaceUris" % UA_NS)
+        self.uris = [NS0_URI] + [u.text.strip() for u in uris] if uris is not None else [NS0_URI]
+        self.uri = self.uris[1]
+        self.aliases = {}
+        aliases = root.find("{%s}Aliases" % UA_NS)
+        if aliases is not None:
+            for a in aliases:
+                self.aliases[a.get("Alias")] = a.text.strip()
+        self.nodes = {}
+        for elem in root:
+            if tag_of(elem).startswith("UA"):
+                self.nodes[self.key(elem.get("NodeId"))] = elem
+
+    def key(self, text):
+        """Make global key (namespace URI, identifier) of NodeId string or alias."""
+        text = self.aliases.get(text.strip(), text)
+        ns, ident = split_node_id(text)
+        return self.uris[ns], ident
+
+    def references(self, elem):
+        refs = elem.find("{%s}References" % UA_NS)
+        if refs is None:
+            return []
+        return [(self.key(r.get("ReferenceType")), r.get("IsForward", "true").lower() != "false",
+                 self.key(r.text), r) for r in refs]
+
+
+def browse_name(elem):
+    name = elem.get("BrowseName")
+    return name.split(":", 1)[1] if ":" in name else name
+
+
+def compute_closure(nodesets, roots):
+    owner = {}
+    for ns in nodesets.values():
+        for key in ns.nodes:
+            owner[key] = ns
+
+    def modelling_rule(key):
+        ns = owner[key]
+        for ref_type, forward, target, _ in ns.references(ns.nodes[key]):
+            if ref_type == HAS_MODELLING_RULE and forward:
+                return target
+        return None
+
+    keep = set()
+    pending = []
+
+    def want(key):
+        if key in owner and key not in keep:
+            keep.add(key)
+            pending.append(key)
+
+    for label, name in roots:
+        ns = nodesets[label]
+        found = [k for k, e in ns.nodes.items() if browse_name(e) == name]
+        if not found:
+            sys.exit("nodeset_closure: root %s:%s not found" % (label, name))
+        for k in found:
+            want(k)
+    for ns in nodesets.values():
+        for key, elem in ns.nodes.items():
+            if tag_of(elem) in ALWAYS_KEEP_TAGS:
+                want(key)
+            for ref_type, forward, target, _ in ns.references(elem):
+                if not forward and ref_type in HIERARCHICAL_CHILD and target[0] == NS0_URI:
+                    want(key)
+
+    while pending:
+        key = pending.pop()
+        ns = owner[key]
+        elem = ns.nodes[key]
+        is_type = tag_of(elem) in TYPE_TAGS
+        is_declaration = modelling_rule(key) is not None
+        if elem.get("DataType") is not None:
+            want(ns.key(elem.get("DataType")))
+        for ref_type, forward, target, _ in ns.references(elem):
+            want(ref_type)
+            if ref_type == HAS_SUBTYPE and not forward:
+                want(target)
+            elif forward and ref_type in DEPENDENCY:
+                want(target)
+            elif forward and ref_type in HIERARCHICAL_CHILD and target in owner:
+                if is_type or is_declaration:
+                    if modelling_rule(target) == MANDATORY:
+                        want(target)
+                else:
+                    want(target)
+    return keep
+
+
+def write_pruned(ns, keep, pruned_uris):
+    root = ns.tree.getroot()
+    removed = 0
+    for elem in list(root):
+        if not tag_of(elem).startswith("UA"):
+            continue
+        if ns.key(elem.get("NodeId")) not in keep:
+            root.remove(elem)
+            removed += 1
+            continue
+        refs = elem.find("{%s}References" % UA_NS)
+        for ref_type, forward, target, r in ns.references(elem):
+            if target[0] in pruned_uris and target not in keep:
+                refs.remove(r)
+    ns.tree.write(ns.out_path, encoding="utf-8", xml_declaration=True)
+    return removed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Prune NodeSet2 files to type closure of given roots.")
+    parser.add_argument("--nodeset", action="append", required=True, metavar="LABEL=IN=OUT")
+    parser.add_argument("--root", action="append", default=[], metavar="LABEL:BrowseName")
+    parser.add_argument("--report", metavar="FILE")
+    args = parser.parse_args()
+
+    nodesets = {}
+    for spec in args.nodeset:
+        label, in_path, out_path = spec.split("=", 2)
+        nodesets[label] = NodeSet(label, in_path, out_path)
+    roots = [tuple(r.split(":", 1)) for r in args.root]
+
+    pruned_uris = {ns.uri for ns in nodesets.values()}
+    keep = compute_closure(nodesets, roots)
+
+    lines = []
+    total_all = kept_all = 0
+    for label, ns in nodesets.items():
+        total = len(ns.nodes)
+        removed = write_pruned(ns, keep, pruned_uris)
+        total_all += total
+        kept_all += total - removed
+        lines.append("%-10s %6d nodes -> %6d nodes (%d dropped)" % (label, total, total - removed, removed))
+    lines.append("%-10s %6d nodes -> %6d nodes (%d dropped)" % ("total", total_all, kept_all, total_all - kept_all))
+    report = "\n".join(lines) + "\n"
+    sys.stdout.write(report)
+    if args.report:
+        with open(args.report, "w") as f:
+            f.write(report)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""
+Generate frame schema and decoder of the device tag map.
+
+The tag map is a CSV file with one row per block of the device frame in wire
+order (see src/frame.h):
+
+    tag,field,encoding,scale,node,unit
+
+    tag       Name of the tag, used in comments of generated code.
+    field     Snapshot field the block is decoded into, e.g. Position for
+              AXIS_POSITION.
+    encoding  be_int32 or be_float32.
+    scale     Factor applied after decoding.
+    node      Browse path of the variable the field is published to relative
+              to the object type given by --type, e.g.
+              ParameterSet/ActualPosition.  Empty if not published.
+    unit      Unit of raw value, used in comments of generated code.
+
+Lines starting with '#' are comments.  The output is a C header with the
+schema as a constant initializer and a decoder calling the block decoder of
+each block with constant encoding and scale, so frames are decoded without
+parsing the map or dispatching on encoding at run time.
+
+Everything that can be checked before compiling is checked here and fails the
+build: unknown field or encoding, a field decoded twice, a node missing from the
+nodeset and a node whose data type can't hold decoded values.
+
+Usage:
+    tagmap_gen.py --tags TAGS.csv --nodeset NodeSet2.xml --type BrowseName
+                  --output OUT.h
+"""
+
+import argparse
+import csv
+import math
+import os
+import sys
+import xml.etree.ElementTree as ET
+
+UA_NS = "http://opcfoundation.org/UA/2011/03/UANodeSet.xsd"
+
+ENCODINGS = {
+    "be_int32": "FRAME_BE_INT32",
+    "be_float32": "FRAME_BE_FLOAT32",
+}
+
+# Data types in namespace 0 which can hold a decoded value, i.e. float.
+FLOAT_DATA_TYPES = {
+    "i=10": "Float",
+    "i=11": "Double",
+    "i=290": "Duration",
+}
+
+HIERARCHICAL_CHILD = {"i=46", "i=47", "i=49", "HasProperty", "HasComponent", "HasOrderedComponent"}
+HAS_SUBTYPE = {"i=45", "HasSubtype"}
+
+# Snapshot fields, i.e. AXIS_* enumerators in src/context.h without prefix.
+FIELDS = ["Position", "Velocity", "Torque", "Temperature"]
+
+COLUMNS = ["tag", "field", "encoding", "scale", "node", "unit"]
+
+
+def fail(path, line, message):
+    sys.exit("%s:%d: error: %s" % (path, line, message))
+
+
+def local_name(browse_name):
+    return browse_name.split(":", 1)[1] if ":" in browse_name else browse_name
+
+
+class NodeSet:
+    """Instance declarations of a NodeSet2 file looked up by browse path."""
+
+    def __init__(self, path):
+        root = ET.parse(path).getroot()
+        self.aliases = {}
+        aliases = root.find("{%s}Aliases" % UA_NS)
+        if aliases is not None:
+            for a in aliases:
+                self.aliases[a.get("Alias")] = a.text.strip()
+        self.nodes = {}
+        self.children = {}
+        self.supertype = {}
+        for elem in root:
+            if elem.tag.split("}", 1)[-1].startswith("UA"):
+                self.nodes[elem.get("NodeId")] = elem
+        for node_id, elem in self.nodes.items():
+            parent = elem.get("ParentNodeId")
+            if parent is not None:
+                self.children.setdefault(parent, set()).add(node_id)
+            refs = elem.find("{%s}References" % UA_NS)
+            for r in refs if refs is not None else []:
+                ref_type = r.get("ReferenceType")
+                forward = r.get("IsForward", "true").lower() != "false"
+                target = r.text.strip()
+                if ref_type in HIERARCHICAL_CHILD:
+                    if forward:
+                        self.children.setdefault(node_id, set()).add(target)
+                    else:
+                        self.children.setdefault(target, set()).add(node_id)
+                elif ref_type in HAS_SUBTYPE and not forward:
+                    self.supertype[node_id] = target
+
+    def find_type(self, name):
+        for node_id, elem in self.nodes.items():
+            if elem.tag.endswith("ObjectType") and local_name(elem.get("BrowseName")) == name:
+                return node_id
+        return None
+
+    def find_child(self, parent, name):
+        for child in self.children.get(parent, ()):
+            elem = self.nodes.get(child)
+            if elem is not None and local_name(elem.get("BrowseName")) == name:
+                return child
+        return None
+
+    def resolve(self, type_id, path):
+        """NodeId of declaration at path under type or its supertypes."""
+        while type_id is not None:
+            node_id = type_id
+            for name in path.split("/"):
+                node_id = self.find_child(node_id, name)
+                if node_id is None:
+                    break
+            if node_id is not None:
+                return node_id
+            type_id = self.supertype.get(type_id)
+        return None
+
+    def data_type(self, node_id):
+        text = self.nodes[node_id].get("DataType", "i=24")
+        return self.aliases.get(text, text)
+
+
+def read_tags(path):
+    rows = []
+    with open(path, newline="") as f:
+        lines = [(n, line) for n, line in enumerate(f, 1) if line.strip() and not line.lstrip().startswith("#")]
+    if not lines:
+        fail(path, 1, "no header row")
+    reader = csv.reader(line for _, line in lines)
+    header = [c.strip() for c in next(reader)]
+    if header != COLUMNS:
+        fail(path, lines[0][0], "header must be %s" % ",".join(COLUMNS))
+    for (line, _), cells in zip(lines[1:], reader):
+        if len(cells) != len(COLUMNS):
+            fail(path, line, "%d columns expected, got %d" % (len(COLUMNS), len(cells)))
+        row = dict(zip(COLUMNS, (c.strip() for c in cells)))
+        row["line"] = line
+        rows.append(row)
+    if not rows:
+        fail(path, lines[0][0], "no tags")
+    return rows
+
+
+def check(path, rows, nodeset, type_name):
+    type_id = None
+    if nodeset is not None:
+        type_id = nodeset.find_type(type_name)
+        if type_id is None:
+            sys.exit("tagmap_gen: object type %s not found in nodeset" % type_name)
+    fields = {}
+    nodes = {}
+    for row in rows:
+        line = row["line"]
+        if row["field"] not in FIELDS:
+            fail(path, line, "unknown field '%s', must be one of %s" % (row["field"], ", ".join(FIELDS)))
+        if row["field"] in fields:
+            fail(path, line, "field %s already decoded by tag %s" % (row["field"], fields[row["field"]]))
+        fields[row["field"]] = row["tag"]
+        if row["encoding"] not in ENCODINGS:
+            fail(path, line, "unknown encoding '%s', must be one of %s"
+                 % (row["encoding"], ", ".join(sorted(ENCODINGS))))
+        try:
+            scale = float(row["scale"])
+        except ValueError:
+            fail(path, line, "scale '%s' is not a number" % row["scale"])
+        if scale == 0.0 or not math.isfinite(scale):
+            fail(path, line, "scale must be finite and non-zero")
+        node = row["node"]
+        if not node:
+            continue
+        leaf = node.split("/")[-1]
+        if not leaf.isalnum():
+            fail(path, line, "node '%s' must end with an alphanumeric browse name" % node)
+        if leaf in nodes:
+            fail(path, line, "node %s already published from tag %s" % (node, nodes[leaf]))
+        nodes[leaf] = row["tag"]
+        if nodeset is None:
+            continue
+        decl = nodeset.resolve(type_id, node)
+        if decl is None:
+            fail(path, line, "node %s not found in %s" % (node, type_name))
+        data_type = nodeset.data_type(decl)
+        if data_type not in FLOAT_DATA_TYPES:
+            fail(path, line, "tag %s is decoded to float but %s/%s has data type %s"
+                 % (row["tag"], type_name, node, data_type))
+
+
+def c_float(text):
+    value = float(text)
+    literal = repr(value)
+    if "e" not in literal and "." not in literal:
+        literal += ".0"
+    return literal + "f"
+
+
+def generate(tags_path, rows):
+    name = os.path.basename(tags_path)
+    out = []
+    out.append("/* Generated by tools/tagmap_gen.py from %s.  Do not edit. */" % name)
+    out.append("#ifndef FRAME_SCHEMA_GENERATED_H")
+    out.append("#define FRAME_SCHEMA_GENERATED_H")
+    out.append("")
+    out.append("#include \"frame.h\"")
+    out.append("")
+    out.append("#define FRAME_SCHEMA_BLOCKS_SIZE %d" % len(rows))
+    out.append("")
+    out.append("/* Blocks of the frame in wire order. */")
+    out.append("#define FRAME_SCHEMA_BLOCKS \\")
+    for i, row in enumerate(rows):
+        last = i + 1 == len(rows)
+        out.append("    { AXIS_%s, %s, %s }%s /* %s: %s */%s" % (
+            row["field"].upper(), ENCODINGS[row["encoding"]], c_float(row["scale"]), "" if last else ",",
+            row["tag"], row["unit"], "" if last else " \\"))
+    out.append("")
+    published = [row for row in rows if row["node"]]
+    if published:
+        out.append("/* Field published to each variable. */")
+        for row in published:
+            out.append("#define FRAME_SCHEMA_%s_FIELD AXIS_%s  /* %s */" % (
+                row["node"].split("/")[-1].upper(), row["field"].upper(), row["node"]))
+        out.append("")
+    out.append("_Static_assert(FRAME_SCHEMA_BLOCKS_SIZE <= AXIS_FIELDS, \"more blocks than fields\");")
+    out.append("")
+    out.append("/*")
+    out.append(" * Decode blocks of a frame of the schema.  Encoding and scale of each block are")
+    out.append(" * constants so no block is dispatched at run time.")
+    out.append(" */")
+    out.append("static inline void")
+    out.append("frame_schema_decode(void (*be_float32)(float* restrict, const uint8_t* restrict, size_t, float),")
+    out.append("                    void (*be_int32)(float* restrict, const uint8_t* restrict, size_t, float),")
+    out.append("                    const uint8_t* block, size_t axes, int robot, snapshot_t* snap) {")
+    for i, row in enumerate(rows):
+        out.append("    %s(snap->value[AXIS_%s][robot], block + %d * axes * 4, axes, %s);" % (
+            row["encoding"], row["field"].upper(), i, c_float(row["scale"])))
+    out.append("}")
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate frame schema and decoder from device tag map.")
+    parser.add_argument("--tags", required=True, metavar="TAGS.csv")
+    parser.add_argument("--nodeset", metavar="NodeSet2.xml",
+                        help="Nodeset declaring --type.  Without it data types of nodes are not checked.")
+    parser.add_argument("--type", default="AxisType", metavar="BrowseName")
+    parser.add_argument("--output", required=True, metavar="OUT.h")
+    args = parser.parse_args()
+
+    rows = read_tags(args.tags)
+    nodeset = NodeSet(args.nodeset) if args.nodeset else None
+    check(args.tags, rows, nodeset, args.type)
+    code = generate(args.tags, rows)
+    with open(args.output, "w") as f:
+        f.write(code)
+
+
+if __name__ == "__main__":
+    main()